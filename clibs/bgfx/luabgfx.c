@@ -193,9 +193,23 @@ memory_keepalive(lua_State *L) {
 	return 0;
 }
 
+static void
+memory_unref(struct memory *mem) {
+	// mem may be freed by lua once ref is 0, read the release before
+	void (*release)(void *ud) = mem->release;
+	void *ud = mem->release_ud;
+	if (atom_dec(&mem->ref) == 0 && release) {
+		release(ud);
+	}
+}
+
 static int
 memory_release(lua_State *L) {
 	struct memory *mem = (struct memory *)lua_touserdata(L, 1);
+	if (mem->release) {
+		// drop the reference of the lua object, the data is released here or by the last releaseMemory
+		memory_unref(mem);
+	}
 	if (mem->ref == 0)
 		return 0;
 	// keep self alive
@@ -218,6 +232,8 @@ memory_new(lua_State *L) {
 	mem->size = 0;
 	mem->ref = 0;
 	mem->constant = 0;
+	mem->release = NULL;
+	mem->release_ud = NULL;
 	if (luaL_newmetatable(L, "BGFX_MEMORY")) {
 		luaL_Reg l[] = {
 			{ "__tostring", memory_tostring },
@@ -256,7 +272,7 @@ static void
 releaseMemory(void *ptr, void *ud) {
 	(void)ptr;	// unused ptr
 	struct memory * mem = (struct memory *)ud;
-	atom_dec(&mem->ref);
+	memory_unref(mem);
 }
 
 static const bgfx_memory_t *
@@ -2683,6 +2699,10 @@ get_offset_size(lua_State *L, void *str_, size_t *sz) {
 		function() returns lightuserdata, size, closeobj_or_closefunc(opt)
 		integer offset (opt)
 		integer size (opt)
+		If closeobj is a userdata with a lightuserdata __release : void (*)(void *ud), and ud is the first field
+		of the userdata, the memory object refers to the data without copying. It takes ud (the field is cleared,
+		so the __gc of closeobj does nothing), and calls __release(ud) when both the memory object is collected and
+		bgfx has released the last reference. The memory is constant.
  */
 static int
 lmemoryBuffer(lua_State *L) {
@@ -2728,9 +2748,23 @@ lmemoryBuffer(lua_State *L) {
 		void * data = lua_touserdata(L, 4);
 		size_t sz = luaL_checkinteger(L, 5);
 		data = get_offset_size(L, data, &sz);
+		int t = lua_type(L, 6);
+		if (t == LUA_TUSERDATA && luaL_getmetafield(L, 6, "__release") == LUA_TLIGHTUSERDATA) {
+			void (*release)(void *ud) = (void (*)(void *))lua_touserdata(L, -1);
+			void **owner = (void **)lua_touserdata(L, 6);
+			lua_settop(L, 6);
+			newMemory(L, data, sz);
+			struct memory *mem = (struct memory *)lua_touserdata(L, -1);
+			mem->constant = 1;
+			// the reference of the lua object, dropped by memory_release
+			mem->ref = 1;
+			mem->release = release;
+			mem->release_ud = *owner;
+			*owner = NULL;
+			return 1;
+		}
 		void * buffer = newMemory(L, NULL, sz);
 		memcpy(buffer, data, sz);
-		int t = lua_type(L, 6);
 		if (t == LUA_TUSERDATA || t == LUA_TTABLE) {
 			if (luaL_getmetafield(L, 6, "__close") == LUA_TFUNCTION) {
 				lua_pushvalue(L, 6);
@@ -4450,6 +4484,17 @@ lsetViewOrder(lua_State *L) {
 	return 0;
 }
 
+static int
+lsetViewScissor(lua_State *L) {
+	bgfx_view_id_t viewid = luaL_checkinteger(L, 1);
+	int x = luaL_optinteger(L, 2, 0);
+	int y = luaL_optinteger(L, 3, 0);
+	int w = luaL_optinteger(L, 4, 0);
+	int h = luaL_optinteger(L, 5, 0);
+	BGFX(set_view_scissor)(viewid, x, y, w, h);
+	return 0;
+}
+
 static int
 lsetViewRect(lua_State *L) {
 	bgfx_view_id_t viewid = luaL_checkinteger(L, 1);
@@ -5446,6 +5491,7 @@ luaopen_bgfx(lua_State *L) {
 		{ "set_view_clear", lsetViewClear },
 		{ "set_view_clear_mrt", lsetViewClearMRT },
 		{ "set_view_rect", lsetViewRect },
+		{ "set_view_scissor", lsetViewScissor },
 		{ "set_view_transform", lsetViewTransform },
 		{ "set_view_order", lsetViewOrder },
 		{ "set_view_name", lsetViewName },
@@ -38,6 +38,9 @@ struct memory {
 	size_t size;
 	int ref;
 	int constant;
+	// releases the zero-copy data with the last reference, see memory_buffer type 6
+	void (*release)(void *ud);
+	void *release_ud;
 };
 
 #if LUA_VERSION_NUM < 504
@@ -23,6 +23,15 @@ struct bgfx_encoder_holder {
 };
 
 struct cull_cached;
+struct scene_hierarchy;
+
+// scene_aabb written by bounding_update in this frame, in entity order
+struct scene_aabb_buffer {
+	const uint64_t*	eids;
+	const uint64_t*	ids;		// math_t of bounding.scene_aabb, the box is stale if it's changed
+	const float*	aabbs;		// min(vec4), max(vec4)
+	uint32_t		n;
+};
 
 struct ecs_world {
 	struct ecs_context*           ecs;
@@ -34,8 +43,8 @@ struct ecs_world {
 	uint64_t                      frame;
 	struct queue_container*       Q;
 	struct submit_cache*          submit_cache;
-	uint64_t                      unused0;
-	uint64_t                      unused1;
+	struct scene_hierarchy*       scene_hierarchy;
+	struct scene_aabb_buffer*     scene_aabbs;
 	uint64_t                      unused2;
 };
 
@@ -128,6 +128,14 @@ static int wrap_close(lua_State* L) {
     return 0;
 }
 
+static void wrap_release(void* cache) {
+    if (cache) {
+        luazip_close((zip_reader_cache*)cache);
+    }
+}
+
+// bgfx.memory_buffer takes the cache from the wrap by __release (cache is the first field),
+// and closes it after bgfx has done with the zero-copy memory object.
 static int wrap_closure(lua_State* L) {
     zip_reader_cache* cache = (zip_reader_cache*)lua_touserdata(L, lua_upvalueindex(1));
     size_t len = 0;
@@ -139,9 +147,12 @@ static int wrap_closure(lua_State* L) {
     if (luaL_newmetatable(L, "fastio::wrap")) {
         luaL_Reg lib[] = {
             { "__close", wrap_close },
+            { "__gc", wrap_close },
             { NULL, NULL },
         };
         luaL_setfuncs(L, lib, 0);
+        lua_pushlightuserdata(L, (void*)wrap_release);
+        lua_setfield(L, -2, "__release");
     }
     lua_setmetatable(L, -2);
     return 3;
@@ -200,6 +211,29 @@ static int readall_f(lua_State *L) {
     return 1;
 }
 
+// map the file instead of reading it, fallback to readall_v when it can't be mapped (e.g. an empty file)
+template <bool RAISE>
+static int mmap_v(lua_State *L) {
+    const char* filename = getfile(L);
+    lua_settop(L, 2);
+    auto cache = luazip_mmap(filename);
+    if (!cache) {
+        return readall_v<RAISE>(L);
+    }
+    lua_pushlightuserdata(L, cache);
+    return 1;
+}
+
+template <bool RAISE>
+static int mmap_f(lua_State *L) {
+    int n = mmap_v<RAISE>(L);
+    if (n != 1) {
+        return n;
+    }
+    lua_pushcclosure(L, wrap_closure, 1);
+    return 1;
+}
+
 template <bool RAISE>
 static int readall_u(lua_State *L) {
     const char* filename = getfile(L);
@@ -395,19 +429,31 @@ static int free(lua_State *L) {
     return 0;
 }
 
+// load from a cache (closed after loading), or a memory function such as fastio.mmap returns
 static int loadlua(lua_State* L) {
-    luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
-    zip_reader_cache* cache = (zip_reader_cache*)lua_touserdata(L, 1);
     const char* symbol = luaL_checkstring(L, 2);
     lua_settop(L, 3);
-    size_t len = 0;
-    void* buf = luazip_data(cache, &len);
+    zip_reader_cache* cache = nullptr;
     LoadS ls;
-    ls.s = (const char*)buf;
-    ls.size = len;
+    if (lua_type(L, 1) == LUA_TFUNCTION) {
+        lua_pushvalue(L, 1);
+        lua_call(L, 0, 3);
+        ls.s = (const char*)lua_touserdata(L, 4);
+        ls.size = (size_t)luaL_checkinteger(L, 5);
+        lua_toclose(L, 6);
+    }
+    else {
+        luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+        cache = (zip_reader_cache*)lua_touserdata(L, 1);
+        size_t len = 0;
+        ls.s = (const char*)luazip_data(cache, &len);
+        ls.size = len;
+    }
     lua_pushfstring(L, "@%s", symbol);
     int status = lua_load(L, getS, &ls, lua_tostring(L, -1), "t");
-    luazip_close(cache);
+    if (cache) {
+        luazip_close(cache);
+    }
     if (status != LUA_OK) {
         luaL_pushfail(L);
         lua_insert(L, -2);
@@ -431,6 +477,9 @@ luaopen_fastio(lua_State* L) {
         {"readall_u", readall_u<true>},
         {"readall_s", readall_s<true>},
         {"readall_s_noerr", readall_s<false>},
+        {"mmap", mmap_f<true>},
+        {"mmap_v", mmap_v<true>},
+        {"mmap_v_noerr", mmap_v<false>},
         {"loadfile", loadfile<true>},
         {"sha1", sha1<true>},
         {"str2sha1", str2sha1},
@@ -0,0 +1,69 @@
+#include "jobpool.h"
+
+#include <cassert>
+
+job_pool::job_pool(int num){
+	assert(num >= 1);
+	threads.reserve(num-1);
+	for (int ii=1; ii<num; ++ii){
+		threads.emplace_back(&job_pool::worker_loop, this, ii);
+	}
+}
+
+job_pool::~job_pool(){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		quit = true;
+	}
+	cv_start.notify_all();
+	for (auto &t : threads){
+		t.join();
+	}
+}
+
+void job_pool::run(const job &j){
+	if (threads.empty()){
+		j(0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		current = &j;
+		pending = (int)threads.size();
+		++generation;
+	}
+	cv_start.notify_all();
+
+	j(0);
+
+	std::unique_lock<std::mutex> lock(mtx);
+	cv_done.wait(lock, [this]{ return pending == 0; });
+	current = nullptr;
+}
+
+void job_pool::worker_loop(int idx){
+	uint64_t seen = 0;
+	for (;;){
+		const job* j;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv_start.wait(lock, [&]{ return quit || generation != seen; });
+			if (quit)
+				return;
+			seen = generation;
+			j = current;
+		}
+
+		(*j)(idx);
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			last = (--pending == 0);
+		}
+		if (last){
+			cv_done.notify_one();
+		}
+	}
+}
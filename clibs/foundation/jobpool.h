@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A tiny fork/join pool: run() calls the job once on every worker and waits for all of them.
+// Worker 0 is always the calling thread, so a pool with size() == 1 has no extra thread.
+struct job_pool {
+	using job = std::function<void (int worker)>;
+
+	explicit job_pool(int num);
+	~job_pool();
+
+	job_pool(const job_pool&) = delete;
+	job_pool& operator=(const job_pool&) = delete;
+
+	int size() const { return (int)threads.size() + 1; }
+	void run(const job &j);
+
+private:
+	void worker_loop(int idx);
+
+	std::vector<std::thread>	threads;
+	std::mutex					mtx;
+	std::condition_variable		cv_start;
+	std::condition_variable		cv_done;
+	const job*					current = nullptr;
+	uint64_t					generation = 0;
+	int							pending = 0;
+	bool						quit = false;
+};
@@ -3,6 +3,7 @@ local lm = require "luamake"
 lm:lua_source "foundation" {
     sources = {
         "vla.c",
-        "set.c"
+        "set.c",
+        "jobpool.cpp",
     }
 }
\ No newline at end of file
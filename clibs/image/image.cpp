@@ -198,6 +198,36 @@ lparse(lua_State *L) {
     return readcontent ? 2 : 1;
 }
 
+// split a 2d texture file into its mip levels, mips[lod+1] is the raw data of mip lod
+static int
+lmipmaps(lua_State *L) {
+    auto memory = getmemory(L, 1);
+    bx::DefaultAllocator defaultAllocator;
+    AlignedAllocator allocator(&defaultAllocator, 16);
+
+    auto image = bimg::imageParse(&allocator, (const void*)memory.data(), (uint32_t)memory.size(), bimg::TextureFormat::Count, nullptr);
+    if (!image){
+        lua_pushstring(L, "Invalid image content");
+        return lua_error(L);
+    }
+    if (image->m_cubeMap || image->m_numLayers > 1 || image->m_depth > 1){
+        bimg::imageFree(image);
+        lua_pushstring(L, "Only 2d texture can be split into mipmaps");
+        return lua_error(L);
+    }
+
+    push_texture_info(L, image);
+    lua_createtable(L, image->m_numMips, 0);
+    for (uint8_t lod = 0; lod < image->m_numMips; ++lod){
+        bimg::ImageMip mip;
+        bimg::imageGetRawData(*image, 0, lod, image->m_data, image->m_size, mip);
+        lua_pushlstring(L, (const char*)mip.m_data, mip.m_size);
+        lua_seti(L, -2, lod+1);
+    }
+    bimg::imageFree(image);
+    return 2;
+}
+
 static bimg::TextureFormat::Enum
 format_from_field(lua_State *L, int idx, const char* fieldname){
     auto t = lua_getfield(L, idx, fieldname);
@@ -992,6 +1022,7 @@ extern "C" int
 luaopen_image(lua_State* L) {
     luaL_Reg lib[] = {
         { "parse",                   lparse },
+        { "mipmaps",                 lmipmaps },
         { "convert",                 lconvert},
         { "encode_image",            lencode_image},
         { "cvt2file",                lcvt2file},
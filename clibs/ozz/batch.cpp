@@ -0,0 +1,412 @@
+#include <lua.hpp>
+#include <bee/lua/binding.h>
+
+#include "ozz.h"
+#include "jobpool.h"
+
+#include <ozz/animation/runtime/sampling_job.h>
+#include <ozz/animation/runtime/blending_job.h>
+#include <ozz/animation/runtime/local_to_model_job.h>
+
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Native state of one animation object: sampling -> blending -> local to model -> skinning palette.
+// It only keeps raw pointers, the skeleton/animations/matrices are owned by the lua object which owns the instance.
+struct ozzAnimationInstance {
+	struct layer {
+		const ozz::animation::Animation* animation;
+		ozz::animation::SamplingJob::Context* context;
+		ozzSoaTransformVector locals;
+		float ratio = 0;
+		float weight = 0;
+	};
+
+	const ozz::animation::Skeleton* skeleton = nullptr;
+	ozzMatrixVector* models = nullptr;
+	ozzMatrixVector* skinning = nullptr;
+	const ozzMatrixVector* inverse_bind_pose = nullptr;
+	const ozzUint16Verctor* joint_remap = nullptr;
+	float threshold = 0.1f;
+
+	// layers are allocated on the world thread, so the jobs never allocate
+	std::vector<std::unique_ptr<layer>> layers;
+	ozzBlendingJobLayerVector blending;
+	ozzSoaTransformVector blended;
+
+	// lod, see set_lod
+	int lod_interval = 1;
+	int lod_step = 0;
+	bool lod_keyed = false;
+	int lod_latest = 0;
+	ozzSoaTransformVector lod_keys[2] = { ozzSoaTransformVector(0), ozzSoaTransformVector(0) };
+	// per soa joint, the lanes which are interpolated between the keys
+	std::vector<uint8_t> lod_lanes;
+	std::vector<uint8_t> joint_depth;
+
+	ozzAnimationInstance(const ozz::animation::Skeleton* ske, ozzMatrixVector* m, float t)
+		: skeleton(ske), models(m), threshold(t), blended(ske->num_soa_joints())
+	{
+		const auto parents = ske->joint_parents();
+		joint_depth.resize(parents.size());
+		for (size_t ii = 0; ii < parents.size(); ++ii) {
+			// parents are always before their children
+			const int p = parents[ii];
+			joint_depth[ii] = p == ozz::animation::Skeleton::kNoParent ? 0 : (uint8_t)std::min(joint_depth[p] + 1, 255);
+		}
+	}
+
+	void set_lod(int interval, int depth) {
+		if (interval > 1) {
+			const size_t n = skeleton->num_soa_joints();
+			for (auto& k : lod_keys) {
+				k.resize(n);
+			}
+			lod_lanes.assign(n, 0);
+			for (size_t ii = 0; ii < joint_depth.size(); ++ii) {
+				if (depth < 0 || joint_depth[ii] <= depth) {
+					lod_lanes[ii / 4] |= 1 << (ii % 4);
+				}
+			}
+		}
+		// the cached keys and the step belong to the old interval, resample on the next run
+		if (interval != lod_interval) {
+			lod_keyed = false;
+			lod_step = 0;
+		}
+		lod_interval = interval;
+	}
+
+	// sample and blend all the layers, pose points to the local transforms
+	bool evaluate(ozz::span<const ozz::math::SoaTransform>& pose) {
+		size_t n = 0;
+		for (auto& l : layers) {
+			if (l->weight <= 0)
+				continue;
+			ozz::animation::SamplingJob job;
+			job.animation = l->animation;
+			job.context = l->context;
+			job.ratio = l->ratio;
+			job.output = ozz::make_span(l->locals);
+			if (!job.Run())
+				return false;
+			auto& bl = blending[n++];
+			bl.transform = ozz::make_span(l->locals);
+			bl.weight = l->weight;
+		}
+
+		if (n == 0) {
+			pose = skeleton->joint_rest_poses();
+		} else if (n == 1) {
+			pose = blending[0].transform;
+		} else {
+			ozz::animation::BlendingJob job;
+			job.layers = ozz::span<const ozz::animation::BlendingJob::Layer>(blending.data(), n);
+			job.output = ozz::make_span(blended);
+			job.threshold = threshold;
+			job.rest_pose = skeleton->joint_rest_poses();
+			if (!job.Run())
+				return false;
+			pose = ozz::make_span(blended);
+		}
+		return true;
+	}
+
+	// a new key is sampled every lod_interval runs, the pose in between is interpolated from the last two keys,
+	// so the lod pose is lod_interval runs behind
+	bool evaluate_lod(ozz::span<const ozz::math::SoaTransform>& pose) {
+		if (lod_step == 0 || !lod_keyed) {
+			if (!evaluate(pose))
+				return false;
+			lod_latest ^= 1;
+			std::copy(pose.begin(), pose.end(), lod_keys[lod_latest].begin());
+			if (!lod_keyed) {
+				lod_keys[lod_latest ^ 1] = lod_keys[lod_latest];
+				lod_keyed = true;
+				lod_step = 0;
+			}
+		}
+		lerp_pose(lod_keys[lod_latest ^ 1].data(), lod_keys[lod_latest].data(), (float)lod_step / lod_interval, blended.data());
+		pose = ozz::make_span(blended);
+		lod_step = (lod_step + 1) % lod_interval;
+		return true;
+	}
+
+	// translation/scale are lerped, rotation is nlerped, the joints deeper than the lod depth stay at the older key
+	static_assert(sizeof(ozz::math::SoaTransform) == sizeof(float) * 40, "SoaTransform is t.xyz r.xyzw s.xyz of 4 lanes");
+	void lerp_pose(const ozz::math::SoaTransform* a, const ozz::math::SoaTransform* b, float t, ozz::math::SoaTransform* out) const {
+		for (size_t ii = 0; ii < lod_lanes.size(); ++ii) {
+			const float* fa = (const float*)&a[ii];
+			const float* fb = (const float*)&b[ii];
+			float* fo = (float*)&out[ii];
+			for (int l = 0; l < 4; ++l) {
+				const float w = (lod_lanes[ii] >> l) & 1 ? t : 0.f;
+				for (int c : { 0, 1, 2, 7, 8, 9 }) {
+					const float va = fa[c*4+l];
+					fo[c*4+l] = va + (fb[c*4+l] - va) * w;
+				}
+				float dot = 0;
+				for (int c = 3; c < 7; ++c) {
+					dot += fa[c*4+l] * fb[c*4+l];
+				}
+				const float wb = dot < 0 ? -w : w;
+				float len = 0;
+				for (int c = 3; c < 7; ++c) {
+					const float q = fa[c*4+l] * (1.f - w) + fb[c*4+l] * wb;
+					fo[c*4+l] = q;
+					len += q * q;
+				}
+				const float inv = len > 0 ? 1.f / std::sqrt(len) : 1.f;
+				for (int c = 3; c < 7; ++c) {
+					fo[c*4+l] *= inv;
+				}
+			}
+		}
+	}
+
+	bool run() {
+		// frozen, keep the last pose
+		if (lod_interval == 0)
+			return true;
+
+		ozz::span<const ozz::math::SoaTransform> pose;
+		if (!(lod_interval == 1 ? evaluate(pose) : evaluate_lod(pose)))
+			return false;
+
+		ozz::animation::LocalToModelJob ltm;
+		ltm.skeleton = skeleton;
+		ltm.input = pose;
+		ltm.output = ozz::make_span(*models);
+		if (!ltm.Run())
+			return false;
+
+		if (skinning) {
+			build_skinning_matrices(*skinning, *models, *inverse_bind_pose, joint_remap);
+		}
+		return true;
+	}
+};
+
+namespace ozzlua::AnimationInstance {
+	static int add_layer(lua_State* L) {
+		auto& inst = bee::lua::checkudata<ozzAnimationInstance>(L, 1);
+		auto& animation = bee::lua::checkudata<ozz::animation::Animation>(L, 2);
+		auto& context = bee::lua::checkudata<ozz::animation::SamplingJob::Context>(L, 3);
+		auto l = std::make_unique<ozzAnimationInstance::layer>(ozzAnimationInstance::layer {
+			&animation, &context, ozzSoaTransformVector(inst.skeleton->num_soa_joints())
+		});
+		inst.layers.push_back(std::move(l));
+		inst.blending.resize(inst.layers.size());
+		lua_pushinteger(L, (lua_Integer)inst.layers.size());
+		return 1;
+	}
+	static int set_skinning(lua_State* L) {
+		auto& inst = bee::lua::checkudata<ozzAnimationInstance>(L, 1);
+		auto& matrices = bee::lua::checkudata<ozzMatrixVector>(L, 2);
+		auto& ibp = bee::lua::checkudata<ozzMatrixVector>(L, 3);
+		const ozzUint16Verctor* remap = lua_isnoneornil(L, 4) ? nullptr : &bee::lua::checkudata<ozzUint16Verctor>(L, 4);
+		if (matrices.size() < ibp.size() || (remap && remap->size() != ibp.size()) || (!remap && inst.models->size() != ibp.size())) {
+			return luaL_error(L, "invalid skinning matrices and inverse bind matrices");
+		}
+		inst.skinning = &matrices;
+		inst.inverse_bind_pose = &ibp;
+		inst.joint_remap = remap;
+		return 0;
+	}
+	// set_lod(interval, depth), interval 0 freezes the pose, n > 1 samples every n-th frame,
+	// depth limits the interpolated joints between the samples, < 0 means all
+	static int set_lod(lua_State* L) {
+		auto& inst = bee::lua::checkudata<ozzAnimationInstance>(L, 1);
+		const int interval = (int)luaL_checkinteger(L, 2);
+		const int depth = (int)luaL_optinteger(L, 3, -1);
+		if (interval < 0 || interval > 255) {
+			return luaL_error(L, "invalid lod interval : %d", interval);
+		}
+		inst.set_lod(interval, depth);
+		return 0;
+	}
+	static void metatable(lua_State* L) {
+		static luaL_Reg lib[] = {
+			{ "add_layer", add_layer },
+			{ "set_skinning", set_skinning },
+			{ "set_lod", set_lod },
+			{ nullptr, nullptr }
+		};
+		luaL_newlibtable(L, lib);
+		luaL_setfuncs(L, lib, 0);
+		lua_setfield(L, -2, "__index");
+	}
+	static int create(lua_State* L) {
+		auto& ske = bee::lua::checkudata<ozz::animation::Skeleton>(L, 1);
+		auto& models = bee::lua::checkudata<ozzMatrixVector>(L, 2);
+		const float threshold = (float)luaL_optnumber(L, 3, 0.1);
+		if (models.size() < (size_t)ske.num_joints()) {
+			return luaL_error(L, "models is smaller than the skeleton : %d < %d", (int)models.size(), ske.num_joints());
+		}
+		bee::lua::newudata<ozzAnimationInstance>(L, &ske, &models, threshold);
+		return 1;
+	}
+}
+
+static constexpr int MAX_ANIMATION_WORKER = 8;
+
+// The workers and the scratch lists of one lua state, every service which loads ozz has its own.
+struct ozzAnimationBatch {
+	struct skinning_target {
+		ozzAnimationInstance* instance;
+		const ozz::math::Float4x4* worldmat;
+		ozzMatrixVector* target;
+	};
+	std::unique_ptr<job_pool> pool;
+	std::vector<ozzAnimationInstance*> instances;
+	std::vector<skinning_target> targets;
+
+	template <typename F>
+	void run(uint32_t count, F&& f) {
+		if (!pool || count < 2) {
+			for (uint32_t ii = 0; ii < count; ++ii) {
+				f(ii);
+			}
+		} else {
+			std::atomic<uint32_t> next{0};
+			pool->run([&](int) {
+				for (uint32_t ii = next++; ii < count; ii = next++) {
+					f(ii);
+				}
+			});
+		}
+	}
+};
+
+namespace ozzlua::AnimationBatch {
+	static void metatable(lua_State* L) {
+	}
+}
+
+static ozzAnimationBatch&
+get_batch(lua_State* L) {
+	return *(ozzAnimationBatch*)lua_touserdata(L, lua_upvalueindex(1));
+}
+
+// read ratio/weight of every layer from the status tables, they are changed by lua directly
+static void
+fetch_layers(lua_State* L, int idx, ozzAnimationInstance& inst) {
+	const int n = (int)inst.layers.size();
+	for (int ii = 0; ii < n; ++ii) {
+		auto& l = *inst.layers[ii];
+		if (lua_rawgeti(L, idx, ii + 1) != LUA_TTABLE) {
+			luaL_error(L, "missing animation layer %d", ii + 1);
+		}
+		lua_getfield(L, -1, "ratio");
+		lua_getfield(L, -2, "weight");
+		l.ratio = (float)lua_tonumber(L, -2);
+		l.weight = (float)lua_tonumber(L, -1);
+		lua_pop(L, 3);
+	}
+}
+
+// RunAnimationJobs({ obj1, obj2, ... }, n), obj.instance is the AnimationInstance, obj.layers are the status tables in layer order
+static int RunAnimationJobs(lua_State* L) {
+	auto& batch = get_batch(L);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	const lua_Integer n = luaL_optinteger(L, 2, (lua_Integer)lua_rawlen(L, 1));
+	batch.instances.clear();
+	for (lua_Integer ii = 1; ii <= n; ++ii) {
+		lua_rawgeti(L, 1, ii);
+		lua_getfield(L, -1, "instance");
+		auto& inst = bee::lua::checkudata<ozzAnimationInstance>(L, -1);
+		lua_getfield(L, -2, "layers");
+		luaL_checktype(L, -1, LUA_TTABLE);
+		fetch_layers(L, lua_gettop(L), inst);
+		lua_pop(L, 3);
+		batch.instances.push_back(&inst);
+	}
+
+	std::atomic<uint32_t> failed{0};
+	batch.run((uint32_t)batch.instances.size(), [&](uint32_t ii) {
+		if (!batch.instances[ii]->run())
+			++failed;
+	});
+	if (failed > 0) {
+		return luaL_error(L, "%d animation jobs failed!", (int)failed);
+	}
+	return 0;
+}
+
+// RunSkinningTransforms(r2l, { instance1, ... }, { worldmat1, ... }, { MatrixVector1, ... }, n)
+// target[i] = worldmat * r2l * skinning palette, worldmat and r2l are math3d.value_ptr.
+// The targets are plain MatrixVectors, lua copies them into new math3d arrays
+static int RunSkinningTransforms(lua_State* L) {
+	auto& batch = get_batch(L);
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	const auto& r2l = *(const ozz::math::Float4x4*)lua_touserdata(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	luaL_checktype(L, 4, LUA_TTABLE);
+	const lua_Integer n = luaL_optinteger(L, 5, (lua_Integer)lua_rawlen(L, 2));
+	batch.targets.clear();
+	for (lua_Integer ii = 1; ii <= n; ++ii) {
+		lua_rawgeti(L, 2, ii);
+		auto& inst = bee::lua::checkudata<ozzAnimationInstance>(L, -1);
+		if (lua_rawgeti(L, 3, ii) != LUA_TLIGHTUSERDATA) {
+			return luaL_error(L, "invalid worldmat %d", (int)ii);
+		}
+		auto worldmat = (const ozz::math::Float4x4*)lua_touserdata(L, -1);
+		lua_rawgeti(L, 4, ii);
+		auto& target = bee::lua::checkudata<ozzMatrixVector>(L, -1);
+		lua_pop(L, 3);
+		if (!inst.skinning || target.size() < inst.skinning->size()) {
+			return luaL_error(L, "invalid skinning target %d", (int)ii);
+		}
+		batch.targets.push_back({ &inst, worldmat, &target });
+	}
+
+	batch.run((uint32_t)batch.targets.size(), [&](uint32_t ii) {
+		const auto& t = batch.targets[ii];
+		const auto& skinning = *t.instance->skinning;
+		auto& target = *t.target;
+		const ozz::math::Float4x4 m = *t.worldmat * r2l;
+		for (size_t jj = 0; jj < skinning.size(); ++jj) {
+			target[jj] = m * skinning[jj];
+		}
+	});
+	return 0;
+}
+
+static int AnimationWorkers(lua_State* L) {
+	auto& batch = get_batch(L);
+	if (!lua_isnoneornil(L, 1)) {
+		const int n = std::clamp((int)luaL_checkinteger(L, 1), 1, MAX_ANIMATION_WORKER);
+		batch.pool.reset(n > 1 ? new job_pool(n) : nullptr);
+	}
+	lua_pushinteger(L, batch.pool ? batch.pool->size() : 1);
+	return 1;
+}
+
+void init_batch(lua_State* L) {
+	static luaL_Reg lib[] = {
+		{ "AnimationInstance", ozzlua::AnimationInstance::create },
+		{ "RunAnimationJobs", RunAnimationJobs },
+		{ "RunSkinningTransforms", RunSkinningTransforms },
+		{ "AnimationWorkers", AnimationWorkers },
+		{ NULL, NULL },
+	};
+	bee::lua::newudata<ozzAnimationBatch>(L);
+	luaL_setfuncs(L, lib, 1);
+}
+
+namespace bee::lua {
+	template <>
+	struct udata<ozzAnimationInstance> {
+		static inline auto name = "ozzAnimationInstance";
+		static inline auto metatable = ozzlua::AnimationInstance::metatable;
+	};
+	template <>
+	struct udata<ozzAnimationBatch> {
+		static inline auto name = "ozzAnimationBatch";
+		static inline auto metatable = ozzlua::AnimationBatch::metatable;
+	};
+}
@@ -6,16 +6,19 @@ lm:lua_source "ozz" {
     deps = {
         "ozz-animation-base",
         "ozz-animation-runtime",
+        "foundation",
     },
     includes = {
         lm.AntDir .. "/3rd/ozz-animation/include",
         lm.AntDir .. "/3rd/bee.lua",
         "../luabind",
+        "../foundation",
     },
     sources = {
         "ozz.cpp",
         "animation.cpp",
         "job.cpp",
+        "batch.cpp",
         "skeleton.cpp",
         "skinning.cpp",
     },
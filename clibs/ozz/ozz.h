@@ -49,3 +49,6 @@ struct ozzBlendingJobLayerVector: public ozz::vector<ozz::animation::BlendingJob
 		: ozz::vector<ozz::animation::BlendingJob::Layer>()
 	{}
 };
+
+// skinning_matrices[i] = current_pose[joint_remap ? joint_remap[i] : i] * inverse_bind_matrices[i]
+void build_skinning_matrices(ozzMatrixVector& skinning_matrices, const ozzMatrixVector& current_pose, const ozzMatrixVector& inverse_bind_matrices, const ozzUint16Verctor* joint_remap);
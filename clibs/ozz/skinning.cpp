@@ -2,6 +2,18 @@
 #include <bee/lua/binding.h>
 #include "ozz.h"
 
+void build_skinning_matrices(ozzMatrixVector& skinning_matrices, const ozzMatrixVector& current_pose, const ozzMatrixVector& inverse_bind_matrices, const ozzUint16Verctor* jarray) {
+	if (jarray) {
+		for (size_t ii = 0; ii < jarray->size(); ++ii){
+			skinning_matrices[ii] = current_pose[(*jarray)[ii]] * inverse_bind_matrices[ii];
+		}
+	} else {
+		for (size_t ii = 0; ii < inverse_bind_matrices.size(); ++ii){
+			skinning_matrices[ii] = current_pose[ii] * inverse_bind_matrices[ii];
+		}
+	}
+}
+
 static int BuildSkinningMatrices(lua_State *L) {
 	auto& skinning_matrices = bee::lua::checkudata<ozzMatrixVector>(L, 1);
 	auto& current_pose = bee::lua::checkudata<ozzMatrixVector>(L, 2);
@@ -19,9 +31,7 @@ static int BuildSkinningMatrices(lua_State *L) {
 				skinning_matrices[ii] = worldmat * m;
 			}
 		} else {
-			for (size_t ii = 0; ii < jarray.size(); ++ii){
-				skinning_matrices[ii] = current_pose[jarray[ii]] * inverse_bind_matrices[ii];
-			}
+			build_skinning_matrices(skinning_matrices, current_pose, inverse_bind_matrices, &jarray);
 		}
 	}
 	else {
@@ -33,9 +43,7 @@ static int BuildSkinningMatrices(lua_State *L) {
 				skinning_matrices[ii] = worldmat * m;
 			}
 		} else {
-			for (size_t ii = 0; ii < inverse_bind_matrices.size(); ++ii){
-				skinning_matrices[ii] = current_pose[ii] * inverse_bind_matrices[ii];
-			}
+			build_skinning_matrices(skinning_matrices, current_pose, inverse_bind_matrices, nullptr);
 		}
 	}
 	return 0;
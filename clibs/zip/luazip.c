@@ -109,6 +109,11 @@ file_open(lua_State *L, const char *filename, const char *mode, struct filename_
 
 #else
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 struct filename_convert {};
 
 static FILE *
@@ -118,6 +123,104 @@ file_open(lua_State *L, const char *filename, const char *mode, struct filename_
 
 #endif
 
+// A read only mapping of a whole file, shared by the caches pointing into it
+struct zip_mapping {
+	char *base;
+	size_t size;
+	long ref;
+};
+
+#ifdef _WIN32
+
+#define atom_inc(ptr) InterlockedIncrement((LONG volatile *)(ptr))
+#define atom_dec(ptr) InterlockedDecrement((LONG volatile *)(ptr))
+#define atom_lock(ptr) while (InterlockedExchange((LONG volatile *)(ptr), 1)) {}
+#define atom_unlock(ptr) InterlockedExchange((LONG volatile *)(ptr), 0)
+
+static struct zip_mapping *
+mapping_open(const char *filename) {
+	struct filename_convert tmp;
+	if (MultiByteToWideChar(CP_UTF8, 0, filename, -1, tmp.tmp, sizeof(tmp) / sizeof(tmp.tmp[0])) == 0)
+		return NULL;
+	HANDLE f = CreateFileW(tmp.tmp, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+		return NULL;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(f, &size) || size.QuadPart == 0) {
+		CloseHandle(f);
+		return NULL;
+	}
+	HANDLE m = CreateFileMappingW(f, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(f);
+	if (m == NULL)
+		return NULL;
+	void *base = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(m);
+	if (base == NULL)
+		return NULL;
+	struct zip_mapping *M = (struct zip_mapping *)malloc(sizeof(*M));
+	if (M == NULL) {
+		UnmapViewOfFile(base);
+		return NULL;
+	}
+	M->base = (char *)base;
+	M->size = (size_t)size.QuadPart;
+	M->ref = 1;
+	return M;
+}
+
+static void
+mapping_unmap(struct zip_mapping *M) {
+	UnmapViewOfFile(M->base);
+}
+
+#else
+
+#define atom_inc(ptr) __sync_add_and_fetch(ptr, 1)
+#define atom_dec(ptr) __sync_sub_and_fetch(ptr, 1)
+#define atom_lock(ptr) while (__sync_lock_test_and_set(ptr, 1)) {}
+#define atom_unlock(ptr) __sync_lock_release(ptr)
+
+static struct zip_mapping *
+mapping_open(const char *filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+	struct zip_mapping *M = (struct zip_mapping *)malloc(sizeof(*M));
+	if (M == NULL) {
+		munmap(base, (size_t)st.st_size);
+		return NULL;
+	}
+	M->base = (char *)base;
+	M->size = (size_t)st.st_size;
+	M->ref = 1;
+	return M;
+}
+
+static void
+mapping_unmap(struct zip_mapping *M) {
+	munmap(M->base, M->size);
+}
+
+#endif
+
+static void
+mapping_release(struct zip_mapping *M) {
+	if (atom_dec(&M->ref) == 0) {
+		mapping_unmap(M);
+		free(M);
+	}
+}
+
 struct ziphandle {
 	zipFile h;
 };
@@ -659,171 +762,432 @@ lzip(lua_State *L) {
 // 4M
 #define READER_DEFAULT_CACHESIZE (1024 * 1024 * 4)
 #define READER_MIN_CACHESIZE 4096
+// caches are allocated in power of 2 size classes, from 256 bytes to 16M. The larger ones are always allocated from heap
+#define READER_MIN_CLASS 8
+#define READER_MAX_CLASS 24
 
+struct zip_reader;
+
+// owner is not NULL when the cache is allocated from the free lists of a reader, size is its capacity then.
+// mapping is not NULL when the data is a part of a mapped file (see luazip_mmap), instead of buffer.
 struct zip_reader_cache {
 	size_t size;
 	size_t length;
 	size_t offset;
+	struct zip_reader *owner;
+	struct zip_mapping *mapping;
+	char *mapped;
+	struct zip_reader_cache *next;
 	uint8_t active;
 	char buffer[7];
 };
 
-static inline struct zip_reader_cache *
-advance_ptr(struct zip_reader_cache *C, size_t sz) {
-	return (struct zip_reader_cache*)((char *)C + sz);
+struct zip_entry {
+	const char *name;
+	lua_Integer pos;
+};
+
+// The reader (reads, prefetch and its unzip handle) is used by the io thread only.
+// The caches are closed by the services which use the files, in their own threads, so the free lists are guarded by the lock.
+struct zip_reader {
+	long ref;	// the ZIP_READER userdata + caches allocated from the free lists
+	long lock;
+	const char *filename;
+	struct zip_mapping *mapping;
+	int n;
+	struct zip_entry *entries;	// sorted by name
+	struct zip_reader_cache **prefetched;	// one slot per entry
+	size_t prefetched_bytes;
+	size_t cached;	// bytes in the free lists
+	size_t cachesize;
+	unzFile zf;	// opened on the first inflate
+	struct zip_reader_cache *freelist[READER_MAX_CLASS + 1];
+};
+
+static size_t
+need_size(size_t sz) {
+	sz += offsetof(struct zip_reader_cache, buffer);
+	sz = (sz + 7) & ~7;	// align to size_t
+	return sz;
+}
+
+static inline int
+size_class(size_t sz) {
+	int c = READER_MIN_CLASS;
+	while (((size_t)1 << c) < sz)
+		++c;
+	return c;
+}
+
+static inline size_t
+cache_bytes(const struct zip_reader_cache *C) {
+	return C->mapping ? 0 : C->length;
 }
 
 static void
-split_cache(lua_State *L, struct zip_reader_cache *C, size_t sz) {
-	struct zip_reader_cache *next = advance_ptr(C, sz);
-	size_t next_sz = C->size - sz;
-	if (next_sz >= sizeof(*C)) {
-		next->size = C->size - sz;
-		next->length = 0;
-		next->offset = 0;
-		next->active = 0;
-		C->size = sz;
-	} else {
-		next = advance_ptr(C, C->size);
-		size_t len = lua_rawlen(L, 1);
-		struct zip_reader_cache * beginptr = (struct zip_reader_cache *)lua_touserdata(L, 1);
-		struct zip_reader_cache * endptr = advance_ptr(beginptr, len);
-		if (next >= endptr)
-			next = beginptr; // rewind ring buffer
+reader_release(struct zip_reader *R) {
+	if (atom_dec(&R->ref) != 0)
+		return;
+	int i;
+	for (i = READER_MIN_CLASS; i <= READER_MAX_CLASS; i++) {
+		struct zip_reader_cache *C = R->freelist[i];
+		while (C) {
+			struct zip_reader_cache *next = C->next;
+			free(C);
+			C = next;
+		}
 	}
-	lua_pushlightuserdata(L, next);
-	lua_setiuservalue(L, 1, 2);
+	if (R->mapping)
+		mapping_release(R->mapping);
+	free(R->prefetched);
+	free(R->entries);
+	free(R);
+}
+
+static struct zip_reader_cache *
+reader_alloc(struct zip_reader *R, size_t sz) {
+	size_t need = need_size(sz);
+	if (need > ((size_t)1 << READER_MAX_CLASS))
+		return luazip_new(sz, NULL);
+	int c = size_class(need);
+	size_t cap = (size_t)1 << c;
+	atom_lock(&R->lock);
+	struct zip_reader_cache *C = R->freelist[c];
+	if (C) {
+		R->freelist[c] = C->next;
+		R->cached -= cap;
+	}
+	atom_unlock(&R->lock);
+	if (C == NULL) {
+		C = (struct zip_reader_cache *)malloc(cap);
+		if (C == NULL)
+			return NULL;
+	}
+	C->size = cap;
+	C->length = sz;
+	C->offset = 0;
+	C->owner = R;
+	C->mapping = NULL;
+	C->next = NULL;
+	C->active = 1;
+	atom_inc(&R->ref);
+	return C;
 }
 
 static void
-merge_cache(lua_State *L, struct zip_reader_cache *C, struct zip_reader_cache *endptr) {
-	struct zip_reader_cache *next = advance_ptr(C, C->size);
-	while (next < endptr) {
-		if (next->active)
-			break;
-		next = advance_ptr(next, next->size);
+reader_free(struct zip_reader *R, struct zip_reader_cache *C) {
+	int c = size_class(C->size);
+	atom_lock(&R->lock);
+	if (R->cached + C->size <= R->cachesize) {
+		C->next = R->freelist[c];
+		R->freelist[c] = C;
+		R->cached += C->size;
+		C = NULL;
 	}
-	C->size = (size_t)((char *)next - (char *)C);
+	atom_unlock(&R->lock);
+	free(C);
+	reader_release(R);
 }
 
+static int
+reader_find(const struct zip_reader *R, const char *name) {
+	int begin = 0, end = R->n;
+	while (begin < end) {
+		int mid = (begin + end) / 2;
+		int c = strcmp(name, R->entries[mid].name);
+		if (c == 0)
+			return mid;
+		if (c < 0)
+			end = mid;
+		else
+			begin = mid + 1;
+	}
+	return -1;
+}
+
+static unzFile
+reader_unzip(struct zip_reader *R) {
+	if (R->zf == NULL)
+		R->zf = unzip_open(NULL, R->filename);
+	return R->zf;
+}
+
+static inline uint32_t
+read_u16(const char *p) {
+	const uint8_t *u = (const uint8_t *)p;
+	return u[0] | (uint32_t)u[1] << 8;
+}
+
+static inline uint32_t
+read_u32(const char *p) {
+	const uint8_t *u = (const uint8_t *)p;
+	return u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16 | (uint32_t)u[3] << 24;
+}
+
+// Stored (uncompressed) entries are pointed into the mapping of the zip file without copying.
+// pos is the offset of the entry in the central directory, the headers are verified, return NULL to read the entry normally
 static struct zip_reader_cache *
-find_cache(lua_State *L, struct zip_reader_cache *C, struct zip_reader_cache *endptr, size_t sz) {
-	while (C < endptr) {
-		if (!C->active)
-			break;
-		C = advance_ptr(C, C->size);
+mapped_entry(struct zip_mapping *M, uint64_t pos) {
+	const char *base = M->base;
+	if (pos + 46 > M->size || read_u32(base + pos) != 0x02014b50)
+		return NULL;
+	const char *cd = base + pos;
+	uint32_t flag = read_u16(cd + 8);
+	uint32_t method = read_u16(cd + 10);
+	uint32_t compressed = read_u32(cd + 20);
+	uint32_t uncompressed = read_u32(cd + 24);
+	uint64_t local = read_u32(cd + 42);
+	if ((flag & 1) || method != 0 || compressed != uncompressed || compressed == 0xffffffff || local == 0xffffffff)
+		return NULL;
+	if (local + 30 > M->size || read_u32(base + local) != 0x04034b50)
+		return NULL;
+	uint64_t data = local + 30 + read_u16(base + local + 26) + read_u16(base + local + 28);
+	if (data + uncompressed > M->size)
+		return NULL;
+	struct zip_reader_cache *C = luazip_new(0, NULL);
+	if (C == NULL)
+		return NULL;
+	atom_inc(&M->ref);
+	C->mapping = M;
+	C->mapped = M->base + data;
+	C->length = uncompressed;
+	return C;
+}
+
+// return NULL and set *err when failed
+static struct zip_reader_cache *
+reader_inflate(struct zip_reader *R, int idx, const char **err) {
+	unz_file_pos pos;
+	luaint_to_file_pos(R->entries[idx].pos, &pos);
+	if (R->mapping) {
+		struct zip_reader_cache *C = mapped_entry(R->mapping, pos.pos_in_zip_directory);
+		if (C)
+			return C;
 	}
-	if (advance_ptr(C, sz) > endptr)
+	unzFile zf = reader_unzip(R);
+	if (zf == NULL) {
+		*err = "open zip";
 		return NULL;
-	if (sz <= C->size) {
-		split_cache(L, C, sz);
+	}
+	struct zip_reader_cache *C = NULL;
+	if (unzGoToFilePos(zf, &pos) != UNZ_OK) {
+		*err = "locate file";
+	} else if (unzOpenCurrentFile(zf) != UNZ_OK) {
+		*err = "open file";
 	} else {
-		merge_cache(L, C, endptr);
-		if (sz <= C->size) {
-			split_cache(L, C, sz);
-		} else {
-			return find_cache(L, advance_ptr(C, C->size), endptr, sz);
+		unz_file_info info;
+		if (unzGetCurrentFileInfo(zf, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK) {
+			*err = "get file info";
+		} else if ((C = reader_alloc(R, info.uncompressed_size)) == NULL) {
+			*err = "out of memory";
+		} else if (info.uncompressed_size != 0 && unzReadCurrentFile(zf, C->buffer, info.uncompressed_size) != (int)info.uncompressed_size) {
+			*err = "read file";
+			luazip_close(C);
+			C = NULL;
+		}
+		if (unzCloseCurrentFile(zf) != UNZ_OK && C) {
+			*err = "CRC";
+			luazip_close(C);
+			C = NULL;
 		}
 	}
 	return C;
 }
 
-static size_t
-need_size(size_t sz) {
-	sz += offsetof(struct zip_reader_cache, buffer);
-	sz = (sz + 7) & ~7;	// align to size_t
-	return sz;
-}
-
 static struct zip_reader_cache *
-alloc_cache(lua_State *L, size_t sz) {
-	lua_getiuservalue(L, 1, 2);	// cache ptr
-	struct zip_reader_cache *C = (struct zip_reader_cache *)lua_touserdata(L, -1);
-	sz = need_size(sz);
-	if (!C->active && C->size >= sz) {
-		split_cache(L, C, sz);
-	} else {
-		size_t len = lua_rawlen(L, 1);
-		struct zip_reader_cache * beginptr = (struct zip_reader_cache *)lua_touserdata(L, 1);
-		struct zip_reader_cache * endptr = advance_ptr(beginptr, len);
-		C = find_cache(L, C, endptr, sz);
-		if (C == NULL) {
-			C = find_cache(L, beginptr, endptr, sz);
-			if (C == NULL) {
-				return NULL;
-			}
-		}
-		split_cache(L, C, sz);
+reader_take(struct zip_reader *R, int idx) {
+	struct zip_reader_cache *C = R->prefetched[idx];
+	if (C) {
+		R->prefetched[idx] = NULL;
+		R->prefetched_bytes -= cache_bytes(C);
 	}
 	return C;
 }
 
+// inflate the entry into the prefetched slot, the prefetched bytes are limited by the cachesize.
+// return 1 if prefetched, 0 if skipped, -1 if failed
 static int
-zipreader_handle(lua_State *L) {
-	lua_settop(L, 3);
-	lua_getiuservalue(L, 1, 1);	// zip read
-	unzFile zf = open_file(L, 4, 2, NULL);
-	if (zf == NULL) {
+reader_prefetch(struct zip_reader *R, int idx) {
+	if (R->prefetched[idx] != NULL || R->prefetched_bytes >= R->cachesize)
 		return 0;
+	const char *err = NULL;
+	struct zip_reader_cache *C = reader_inflate(R, idx, &err);
+	if (C == NULL)
+		return -1;
+	R->prefetched[idx] = C;
+	R->prefetched_bytes += cache_bytes(C);
+	return 1;
+}
+
+static void
+reader_detach(struct zip_reader *R) {
+	// nobody reads anymore, drop the prefetched caches (they keep references) and the unzip handle
+	int i;
+	for (i = 0; i < R->n; i++) {
+		struct zip_reader_cache *C = reader_take(R, i);
+		if (C)
+			luazip_close(C);
 	}
-	int no_extra_buffer = lua_toboolean(L, 3);
-	unz_file_info info;
-	int err = unzGetCurrentFileInfo(zf, &info, NULL, 0, NULL, 0, NULL, 0);
-	if (err != UNZ_OK)
-		luaL_error(L, "Error: get file info %s", lua_tostring(L, 2));
-	size_t sz = info.uncompressed_size;
-	struct zip_reader_cache *C = alloc_cache(L, sz);
-	if (C == NULL) {
-		if (!no_extra_buffer) {
-			C = luazip_new(sz, NULL);
-			if (C == NULL) {
-				return luaL_error(L, "Out of memory for file %s", lua_tostring(L, 2));
-			}
-		} else {
-			close_file(L, zf);
-			lua_pushboolean(L, 0);
-			lua_pushinteger(L, need_size(sz));
-			return 2;
-		}
+	if (R->zf) {
+		unzClose(R->zf);
+		R->zf = NULL;
 	}
-	if (sz != 0) {
-		int bytes = unzReadCurrentFile(zf, C->buffer, sz);
-		if (bytes != sz) {
-			close_file(L, zf);
-			luaL_error(L, "Error: read file %s (%d != %d)", lua_tostring(L, 2), bytes, (int)sz);
-		}
+	reader_release(R);
+}
+
+struct reader_ud {
+	struct zip_reader *R;
+};
+
+static struct zip_reader *
+check_reader(lua_State *L, int index) {
+	struct reader_ud *ud = (struct reader_ud *)luaL_checkudata(L, index, "ZIP_READER");
+	if (ud->R == NULL)
+		luaL_error(L, "Error: closed reader");
+	return ud->R;
+}
+
+static int
+lreader_gc(lua_State *L) {
+	struct reader_ud *ud = (struct reader_ud *)lua_touserdata(L, 1);
+	if (ud->R) {
+		reader_detach(ud->R);
+		ud->R = NULL;
+	}
+	return 0;
+}
+
+static int
+lreader_call(lua_State *L) {
+	struct zip_reader *R = check_reader(L, 1);
+	const char *name = luaL_checkstring(L, 2);
+	int idx = reader_find(R, name);
+	if (idx < 0)
+		return 0;
+	struct zip_reader_cache *C = reader_take(R, idx);
+	if (C == NULL) {
+		const char *err = NULL;
+		C = reader_inflate(R, idx, &err);
+		if (C == NULL)
+			return luaL_error(L, "Error: %s %s", err, name);
 	}
-	C->length = sz;
-	C->offset = 0;
-	C->active = 1;
-	close_file(L, zf);
 	lua_pushlightuserdata(L, C);
 	return 1;
 }
 
+// reader:prefetch { filenames } inflates the files ahead of use, return the number of prefetched files
 static int
-lreader(lua_State *L) {
-	luaL_checkudata(L, 1, "ZIP_READ");
-	lua_Integer sz = luaL_optinteger(L, 2, READER_DEFAULT_CACHESIZE);
-	if (sz < READER_MIN_CACHESIZE)
-		sz = READER_MIN_CACHESIZE;
-	struct zip_reader_cache *C = (struct zip_reader_cache *)lua_newuserdatauv(L, sz, 2);
-	C->size = sz;
-	C->length = 0;
-	C->offset = 0;
-	C->active = 0;
-	lua_pushvalue(L, 1);
-	lua_setiuservalue(L, -2, 1);
-	lua_pushlightuserdata(L, C);
-	lua_setiuservalue(L, -2, 2);
+lreader_prefetch(lua_State *L) {
+	struct zip_reader *R = check_reader(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int n = (int)lua_rawlen(L, 2);
+	int i;
+	int count = 0;
+	for (i = 1; i <= n; i++) {
+		if (lua_rawgeti(L, 2, i) == LUA_TSTRING) {
+			int idx = reader_find(R, lua_tostring(L, -1));
+			if (idx >= 0 && reader_prefetch(R, idx) > 0)
+				++count;
+		}
+		lua_pop(L, 1);
+	}
+	lua_pushinteger(L, count);
+	return 1;
+}
+
+static void
+reader_push(lua_State *L, struct zip_reader *R) {
+	struct reader_ud *ud = (struct reader_ud *)lua_newuserdatauv(L, sizeof(*ud), 0);
+	ud->R = R;
 	if (luaL_newmetatable(L, "ZIP_READER")) {
 		luaL_Reg l[] = {
-			{ "__call", zipreader_handle },
+			{ "__call", lreader_call },
+			{ "__gc", lreader_gc },
+			{ "__index", NULL },
+			{ "close", lreader_gc },
+			{ "prefetch", lreader_prefetch },
 			{ NULL, NULL },
 		};
 		luaL_setfuncs(L, l, 0);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
 	}
 	lua_setmetatable(L, -2);
+}
+
+static int
+compar_entry(const void *a, const void *b) {
+	return strcmp(((const struct zip_entry *)a)->name, ((const struct zip_entry *)b)->name);
+}
+
+/*
+	userdata ZIP_READ
+	integer cachesize (opt) : the max bytes of the free lists and of the prefetched files
+	boolean mmap (opt) : map the zip file, the stored entries are read without copying
+*/
+static int
+lreader(lua_State *L) {
+	luaL_checkudata(L, 1, "ZIP_READ");
+	lua_Integer cachesize = luaL_optinteger(L, 2, READER_DEFAULT_CACHESIZE);
+	if (cachesize < READER_MIN_CACHESIZE)
+		cachesize = READER_MIN_CACHESIZE;
+	int map = lua_toboolean(L, 3);
+	lua_settop(L, 3);
+	if (lua_getiuservalue(L, 1, 1) != LUA_TTABLE)
+		return luaL_error(L, "Invalid zip userdata");
+	if (lua_rawgeti(L, 4, 0) != LUA_TSTRING)
+		return luaL_error(L, "No zip filename");
+	size_t filename_sz;
+	const char *filename = lua_tolstring(L, 5, &filename_sz);
+	// entries, names and filename are in one block
+	int n = 0;
+	size_t strsz = filename_sz + 1;
+	lua_pushnil(L);
+	while (lua_next(L, 4) != 0) {
+		if (lua_type(L, -2) == LUA_TSTRING) {
+			size_t sz;
+			lua_tolstring(L, -2, &sz);
+			strsz += sz + 1;
+			++n;
+		}
+		lua_pop(L, 1);
+	}
+	struct zip_reader *R = (struct zip_reader *)calloc(1, sizeof(*R));
+	char *block = (char *)malloc(sizeof(struct zip_entry) * n + strsz);
+	struct zip_reader_cache **prefetched = (struct zip_reader_cache **)calloc(n + 1, sizeof(*prefetched));
+	if (R == NULL || block == NULL || prefetched == NULL) {
+		free(R);
+		free(block);
+		free(prefetched);
+		return luaL_error(L, "Error: out of memory");
+	}
+	R->ref = 1;
+	R->n = n;
+	R->entries = (struct zip_entry *)block;
+	R->prefetched = prefetched;
+	R->cachesize = (size_t)cachesize;
+	char *str = block + sizeof(struct zip_entry) * n;
+	memcpy(str, filename, filename_sz + 1);
+	R->filename = str;
+	str += filename_sz + 1;
+	int i = 0;
+	lua_pushnil(L);
+	while (lua_next(L, 4) != 0) {
+		if (lua_type(L, -2) == LUA_TSTRING) {
+			size_t sz;
+			const char *name = lua_tolstring(L, -2, &sz);
+			memcpy(str, name, sz + 1);
+			R->entries[i].name = str;
+			R->entries[i].pos = lua_tointeger(L, -1);
+			str += sz + 1;
+			++i;
+		}
+		lua_pop(L, 1);
+	}
+	qsort(R->entries, n, sizeof(struct zip_entry), compar_entry);
+	if (map)
+		R->mapping = mapping_open(R->filename);
+	reader_push(L, R);
 	return 1;
 }
 
@@ -833,26 +1197,27 @@ lreader_consume(lua_State *L) {
 	struct zip_reader_cache *C = (struct zip_reader_cache *)lua_touserdata(L, 1);
 	if (C->active == 0)
 		return luaL_error(L, "Inactive reader handle");
-	lua_pushlstring(L, C->buffer, C->length);
-	C->active = 0;
+	size_t sz;
+	const char *data = (const char *)luazip_data(C, &sz);
+	lua_pushlstring(L, data, sz);
+	luazip_close(C);
 	return 1;
 }
 
 static int
 lreader_dump(lua_State *L) {
-	luaL_Buffer b;
-	luaL_buffinit(L, &b);
-	struct zip_reader_cache *C = (struct zip_reader_cache *)luaL_checkudata(L, 1, "ZIP_READER");
-	lua_getiuservalue(L, 1, 2);
-	struct zip_reader_cache *head = (struct zip_reader_cache *)lua_touserdata(L, -1);
-	size_t len = lua_rawlen(L, 1);
-	struct zip_reader_cache * endptr = advance_ptr(C, len);
-	while (C < endptr) {
-		lua_pushfstring(L, "%p (size = %I length = %I%s) %s\n", C, C->size, C->length, C->active ? " *" : "", (C == head) ? "<=" : "");
-		luaL_addvalue(&b);
-		C = advance_ptr(C, C->size);
-	}
-	luaL_pushresult(&b);
+	struct zip_reader *R = check_reader(L, 1);
+	int prefetched = 0;
+	int i;
+	for (i = 0; i < R->n; i++) {
+		if (R->prefetched[i])
+			++prefetched;
+	}
+	atom_lock(&R->lock);
+	size_t cached = R->cached;
+	atom_unlock(&R->lock);
+	lua_pushfstring(L, "entries = %d prefetched = %d (%I bytes) cached = %I",
+		R->n, prefetched, (lua_Integer)R->prefetched_bytes, (lua_Integer)cached);
 	return 1;
 }
 
@@ -867,14 +1232,40 @@ luazip_new(size_t sz, struct zip_reader_cache *old) {
 	}
 	C->size = 0;
 	C->length = sz;
+	C->offset = 0;
+	C->owner = NULL;
+	C->mapping = NULL;
+	C->next = NULL;
 	C->active = 1;
 	return C;
 }
 
+struct zip_reader_cache *
+luazip_mmap(const char *filename) {
+	struct zip_mapping *M = mapping_open(filename);
+	if (M == NULL)
+		return NULL;
+	struct zip_reader_cache *C = luazip_new(0, NULL);
+	if (C == NULL) {
+		mapping_release(M);
+		return NULL;
+	}
+	C->mapping = M;
+	C->mapped = M->base;
+	C->length = M->size;
+	return C;
+}
+
 void
 luazip_close(struct zip_reader_cache *f) {
+	if (f->mapping) {
+		mapping_release(f->mapping);
+		f->mapping = NULL;
+	}
 	f->active = 0;
-	if (f->size == 0) {
+	if (f->owner) {
+		reader_free(f->owner, f);
+	} else {
 		free(f);
 	}
 }
@@ -884,12 +1275,12 @@ luazip_data(struct zip_reader_cache *f, size_t *sz) {
 	if (sz) {
 		*sz = f->length;
 	}
-	return f->buffer;
+	return f->mapping ? f->mapped : f->buffer;
 }
 
 size_t
 luazip_read(struct zip_reader_cache *f, void *buf, size_t sz) {
-	void * src = f->buffer + f->offset;
+	const char * src = (const char *)luazip_data(f, NULL) + f->offset;
 	size_t len = f->length - f->offset;
 	if (len >= sz) {
 		memcpy(buf, src, sz);
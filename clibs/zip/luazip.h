@@ -9,6 +9,8 @@ struct zip_reader_cache;
 
 struct zip_reader_cache * luazip_open(const char *filename);
 struct zip_reader_cache * luazip_new(size_t sz, struct zip_reader_cache *);
+// map the whole file read only, NULL if it can't be mapped (e.g. an empty file)
+struct zip_reader_cache * luazip_mmap(const char *filename);
 void luazip_close(struct zip_reader_cache *f);
 void* luazip_data(struct zip_reader_cache *f, size_t *sz);
 size_t luazip_read(struct zip_reader_cache *f, void *buf, size_t sz);
@@ -52,6 +52,10 @@ function vfs.resource_setting(setting)
 	return send("RESOURCE_SETTING", setting)
 end
 
+function vfs.prefetch(paths)
+	return send("PREFETCH", paths)
+end
+
 function vfs.version()
 	return call("VERSION")
 end
@@ -195,6 +195,10 @@ local function response_err(id, msg)
 end
 
 local CMD = {}
+-- hashes of the files to prefetch, see CMD.PREFETCH
+local prefetch_queue = {}
+local prefetch_head = 1
+local prefetch_tail = 0
 
 
 local function schedule_message()
@@ -208,7 +212,20 @@ local function schedule_message()
 	end
 end
 
+local function prefetch_step()
+	local hash = prefetch_queue[prefetch_head]
+	prefetch_queue[prefetch_head] = nil
+	prefetch_head = prefetch_head + 1
+	if prefetch_head > prefetch_tail then
+		prefetch_head, prefetch_tail = 1, 0
+	end
+	repo:prefetch { hash }
+end
+
 local function event_select(timeout)
+	if prefetch_head <= prefetch_tail then
+		timeout = 0
+	end
 	if connection.fd then
 		local sending = connection.sendq
 		if #sending > 0  then
@@ -223,6 +240,9 @@ local function event_select(timeout)
 	if ltask then
 		schedule_message()
 	end
+	if prefetch_head <= prefetch_tail then
+		prefetch_step()
+	end
 end
 
 local function request_send(...)
@@ -428,6 +448,20 @@ function CMD.READ(id, fullpath)
 	end
 end
 
+-- inflate the files in the bundle ahead of READ, the files not listed yet are ignored.
+-- They are queued, and inflated one per loop of event_select, so the requests are not blocked by a prefetch.
+function CMD.PREFETCH(_, paths)
+	for _, fullpath in ipairs(paths) do
+		local path, name = fullpath:gsub("|", "/"):match "^(.*/)([^/]*)$"
+		local dir = path and repo:list(path)
+		local v = dir and dir[name]
+		if v and v.type == 'f' then
+			prefetch_tail = prefetch_tail + 1
+			prefetch_queue[prefetch_tail] = v.hash
+		end
+	end
+end
+
 function CMD.RESOURCE_SETTING(_, setting)
 --	print("[request] RESOURCE_SETTING", setting)
 	repo:resource_setting(setting)
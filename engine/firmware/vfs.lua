@@ -67,7 +67,7 @@ function vfs.new(config)
 		print("Can't open " .. repo.bundlepath .. "00.zip")
 	else
 		repo.zipfile = zipfile
-		repo.zipreader = zip.reader(zipfile, repo.cachesize)
+		repo.zipreader = zip.reader(zipfile, repo.cachesize, true)
 		repo.ziproot = fastio.readall_s(repo.bundlepath .. "00.hash")
 	end
 	setmetatable(repo, vfs)
@@ -108,7 +108,14 @@ function vfs:open(hash)
 			return c
 		end
 	end
-	return fastio.readall_v_noerr(self.localpath .. "/" .. hash)
+	return fastio.mmap_v_noerr(self.localpath .. "/" .. hash)
+end
+
+function vfs:prefetch(hashes)
+	if self.zipreader then
+		return self.zipreader:prefetch(hashes)
+	end
+	return 0
 end
 
 local function get_cachepath(setting, name)
@@ -154,6 +154,8 @@ do
 			end
 		end
 	end
+	function CMD.PREFETCH()
+	end
 	function CMD.REPOPATH()
 		return initargs.repopath
 	end
@@ -121,6 +121,9 @@ end
 function vfs.resource_setting(setting)
 	return send("RESOURCE_SETTING", setting)
 end
+function vfs.prefetch(paths)
+	return send("PREFETCH", paths)
+end
 function vfs.version()
 	return call("VERSION")
 end
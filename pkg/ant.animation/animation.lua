@@ -5,29 +5,45 @@ local w = world.w
 local assetmgr = import_package "ant.asset"
 local ozz = require "ozz"
 local skinning = ecs.require "skinning"
+local lod = ecs.require "lod"
+
+local setting = import_package "ant.settings"
+local ANIMATION_WORKERS <const> = setting:get "graphic/animation/workers" or 1
+local BLENDING_THRESHOLD <const> = 0.1
 
 local m = ecs.system "animation_system"
 
+function m:init()
+    ozz.AnimationWorkers(ANIMATION_WORKERS)
+end
+
 local function create(filename)
     local data = assetmgr.resource(filename)
     local skeleton = data.skeleton
+    local models = ozz.MatrixVector(skeleton:num_joints())
+    local skin = skinning.create(data.meshskin, skeleton)
+    local instance = ozz.AnimationInstance(skeleton, models, BLENDING_THRESHOLD)
+    instance:set_skinning(skin.matrices, skin.inverse_bind_pose, skin.joint_remap)
     local status = {}
+    -- status in the layer order of instance
+    local layers = {}
     for name, handle in pairs(data.animations) do
-        status[name] = {
+        local s = {
             handle = handle,
             sampling = ozz.SamplingJobContext(handle:num_tracks()),
             ratio = 0,
             weight = 0,
         }
+        status[name] = s
+        layers[instance:add_layer(handle, s.sampling)] = s
     end
     local obj = {
         skeleton = skeleton,
         status = status,
-        blending_layers = ozz.BlendingJobLayerVector(),
-        blending_threshold = 0.1,
-        locals_pool = {},
-        models = ozz.MatrixVector(skeleton:num_joints()),
-        skinning = skinning.create(data.meshskin, skeleton),
+        layers = layers,
+        instance = instance,
+        models = models,
+        skinning = skin,
     }
     return obj
 end
@@ -48,54 +64,21 @@ function m:component_init()
     end
 end
 
-local function resize_locals(ani, n)
-    local locals = ani.locals_pool
-    if #locals < n then
-        local size = ani.skeleton:num_soa_joints()
-        for i = #locals + 1, n do
-            locals[i] = ozz.SoaTransformVector(size)
-        end
-    end
-end
-
-local function sampling(ani)
-    local skeleton = ani.skeleton
-    local layer = {}
-    for _, status in pairs(ani.status) do
-        if status.weight > 0 then
-            layer[#layer+1] = status
-        end
-    end
-    if #layer == 0 then
-        ozz.LocalToModelJob(skeleton, nil, ani.models)
-        return
-    elseif #layer == 1 then
-        resize_locals(ani, 1)
-        local status = layer[1]
-        local locals = ani.locals_pool[1]
-        ozz.SamplingJob(status.handle, status.sampling, locals, status.ratio)
-        ozz.LocalToModelJob(skeleton, locals, ani.models)
-        return
-    end
-    local layers = ani.blending_layers
-    layers:resize(#layer)
-    resize_locals(ani, #layer + 1)
-    for i = 1, #layer do
-        local status = layer[i]
-        local locals = ani.locals_pool[i]
-        ozz.SamplingJob(status.handle, status.sampling, locals, status.ratio)
-        layers:set(i, locals, status.weight)
-    end
-    local locals = ani.locals_pool[#layer + 1]
-    ozz.BlendingJob(layers, locals, skeleton, ani.blending_threshold)
-    ozz.LocalToModelJob(skeleton, locals, ani.models)
-end
+-- sampling, blending, local to model and skinning palette of all the changed animations run in one native call
+local changed = {}
 
 function m:animation_sample()
+    lod.update()
+    local n = 0
     for e in w:select "animation_changed animation:in" do
-        local obj = e.animation
-        sampling(obj)
-        skinning.build(obj.models, obj.skinning)
+        n = n + 1
+        changed[n] = e.animation
+    end
+    if n > 0 then
+        ozz.RunAnimationJobs(changed, n)
+        for i = 1, n do
+            changed[i] = nil
+        end
     end
 end
 
@@ -0,0 +1,72 @@
+local ecs = ...
+local world = ecs.world
+local w = world.w
+
+local setting = import_package "ant.settings"
+local ENABLE_LOD <const> = setting:get "graphic/animation/lod/enable"
+
+local api = {}
+
+if not ENABLE_LOD then
+    function api.update()
+    end
+    return api
+end
+
+local LOD_DISTANCE <const> = setting:get "graphic/animation/lod/distance" or {}
+local LOD_DEPTH <const> = setting:get "graphic/animation/lod/depth" or -1
+
+local math3d = require "math3d"
+local Q = world:clibs "render.queue"
+local qm = ecs.require "ant.render|queue_mgr"
+
+local frame = 0
+
+-- cull result of last frame, the animation is frozen when none of its skinned meshes is visible in main queue
+local function mark_visible(main_queue)
+    for e in w:select "skinning:in render_object:in" do
+        local ro = e.render_object
+        if Q.visible(ro.visible_idx, ro.cull_idx, main_queue) then
+            e.skinning.visible_frame = frame
+        end
+    end
+end
+
+local function select_lod(distance)
+    for i = #LOD_DISTANCE, 1, -1 do
+        if distance > LOD_DISTANCE[i] then
+            return 1 << i, i == #LOD_DISTANCE and LOD_DEPTH or -1
+        end
+    end
+    return 1, -1
+end
+
+local function set_lod(obj, interval, depth)
+    if obj.lod_interval ~= interval or obj.lod_depth ~= depth then
+        obj.lod_interval, obj.lod_depth = interval, depth
+        obj.instance:set_lod(interval, depth)
+    end
+end
+
+function api.update()
+    local mq = w:first "main_queue camera_ref:in"
+    if not mq then
+        return
+    end
+    frame = frame + 1
+    mark_visible(qm.queue_index "main_queue")
+
+    local ce <close> = world:entity(mq.camera_ref, "scene:in")
+    local eyepos = math3d.index(ce.scene.worldmat, 4)
+    for e in w:select "animation_changed animation:in scene:in" do
+        local obj = e.animation
+        if obj.skinning.visible_frame ~= frame then
+            set_lod(obj, 0, -1)
+        else
+            local distance = math3d.length(math3d.sub(math3d.index(e.scene.worldmat, 4), eyepos))
+            set_lod(obj, select_lod(distance))
+        end
+    end
+end
+
+return api
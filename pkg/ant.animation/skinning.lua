@@ -10,6 +10,7 @@ end
 local ENABLE_TAA <const> = setting:get "graphic/postprocess/taa/enable"
 
 local imaterial = ecs.require "ant.asset|material"
+local idr = ecs.require "ant.render|dirty_rect.dirty_rect"
 local mathpkg = import_package "ant.math"
 local assetmgr = import_package "ant.asset"
 local ozz = require "ozz"
@@ -20,17 +21,37 @@ local r2l_mat <const> = mathpkg.constant.R2L_MAT
 local m = ecs.system "skinning_system"
 local api = {}
 
+local instances = {}
+local worldmats = {}
+local targets = {}
+
+-- world * r2l * palette of all the changed animations run in one native pass into skinning.world,
+-- then each result is copied into a new marked array, the ids are never written in place
 function m:follow_scene_update()
 	for e in w:select "scene_changed animation animation_changed?out" do
 		e.animation_changed = true
 	end
+	local n = 0
 	for e in w:select "animation_changed animation:in scene:in" do
-		local skinning = e.animation.skinning
-		local sm = skinning.matrices
-		local matrices = math3d.array_matrix_ref(sm:pointer(), sm:count())
-		local mat = math3d.mul(e.scene.worldmat, r2l_mat)
-		math3d.unmark(skinning.matrices_id)
-		skinning.matrices_id = math3d.mark(math3d.mul_array(mat, matrices))
+		local obj = e.animation
+		n = n + 1
+		instances[n] = obj.instance
+		worldmats[n] = math3d.value_ptr(e.scene.worldmat)
+		targets[n] = obj.skinning.world
+	end
+	if n > 0 then
+		ozz.RunSkinningTransforms(math3d.value_ptr(r2l_mat), instances, worldmats, targets, n)
+		for i = 1, n do
+			instances[i] = nil
+			worldmats[i] = nil
+			targets[i] = nil
+		end
+		for e in w:select "animation_changed animation:in" do
+			local skinning = e.animation.skinning
+			local world = skinning.world
+			math3d.unmark(skinning.matrices_id)
+			skinning.matrices_id = math3d.mark(math3d.array_matrix_ref(world:pointer(), world:count()))
+		end
 	end
 	w:propagate("scene", "animation_changed")
 end
@@ -47,12 +68,26 @@ if ENABLE_TAA then
 			end
 			skinning.prev_matrices_id = math3d.mark(skinning.matrices_id)
 			e.render_object.worldmat = skinning.matrices_id
+			-- the pose can move out of the bounding, see dirty_rect
+			idr.full_redraw()
 		end
 	end
 else
 	function m:skin_mesh()
 		for e in w:select "animation_changed skinning:in render_object:update" do
 			e.render_object.worldmat = e.skinning.matrices_id
+			-- the pose can move out of the bounding, see dirty_rect
+			idr.full_redraw()
+		end
+	end
+end
+
+function m:entity_remove()
+	for e in w:select "REMOVED animation:in" do
+		local skinning = e.animation.skinning
+		math3d.unmark(skinning.matrices_id)
+		if skinning.prev_matrices_id then
+			math3d.unmark(skinning.prev_matrices_id)
 		end
 	end
 end
@@ -69,6 +104,8 @@ function api.create(filename, skeleton)
 		inverse_bind_pose = skin.inverse_bind_pose,
 		joint_remap = skin.joint_remap,
 		matrices = ozz.MatrixVector(count),
+		-- world space palette, written by RunSkinningTransforms
+		world = ozz.MatrixVector(count),
 		matrices_id = mathpkg.constant.NULL,
 	}
 end
@@ -29,6 +29,22 @@ function m.material_unmark(pid)
 	return ltask.call(ServiceResource, "material_unmark", pid)
 end
 
+function m.material_prewarm(record)
+	return ltask.call(ServiceResource, "material_prewarm", record)
+end
+
+function m.material_prewarm_pending()
+	return ltask.call(ServiceResource, "material_prewarm_pending")
+end
+
+function m.material_record_begin()
+	return ltask.call(ServiceResource, "material_record_begin")
+end
+
+function m.material_record_end(path)
+	return ltask.call(ServiceResource, "material_record_end", path)
+end
+
 function m.material_isvalid(pid)
 	local h = PM.program_get(pid)
 	return (0xffff&h) ~= 0xffff
@@ -39,6 +39,9 @@ local function loader(filename)
 			systems = ad.systems,
 			object = MA.material_load(filename .. "|di", material.state, material.stencil, material.fx.di.prog, ad.systems, ad.attribs)
 		}
+		if material.object then
+			MA.material_instanced(material.object, material.di.object)
+		end
 	end
     return material
 end
@@ -46,6 +49,14 @@ end
 local function unloader(m)
 	m.object:release()
 	m.object = nil
+	if m.depth then
+		m.depth.object:release()
+		m.depth.object = nil
+	end
+	if m.di then
+		m.di.object:release()
+		m.di.object = nil
+	end
 
 	local function destroy_handle(fx, n)
 		local h = fx[n]
@@ -56,6 +56,10 @@ assetmgr.material_check		= async.material_check
 assetmgr.material_mark		= async.material_mark
 assetmgr.material_unmark	= async.material_unmark
 assetmgr.material_isvalid	= async.material_isvalid
+assetmgr.material_prewarm	= async.material_prewarm
+assetmgr.material_prewarm_pending = async.material_prewarm_pending
+assetmgr.material_record_begin = async.material_record_begin
+assetmgr.material_record_end = async.material_record_end
 
 assetmgr.textures 			= texture_mgr.textures
 assetmgr.default_textureid	= texture_mgr.default_textureid
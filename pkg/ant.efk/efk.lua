@@ -23,6 +23,7 @@ local ivs       = ecs.require "ant.render|visible_state"
 local qm        = ecs.require "ant.render|queue_mgr"
 local ilight    = ecs.require "ant.render|light.light"
 local iviewport = ecs.require "ant.render|viewport.state"
+local idr       = ecs.require "ant.render|dirty_rect.dirty_rect"
 local iom       = ecs.require "ant.objcontroller|obj_motion"
 local efk_sys = ecs.system "efk_system"
 local iefk = {}
@@ -272,6 +273,19 @@ local function get_light_direction(dl)
     return math3d.serialize(iom.get_direction(dl))
 end
 
+-- any effect visible in the last frame
+local efk_shown = false
+
+-- particles have no bounding, keep the whole main view redrawn while any effect is visible,
+-- and on the frame after the last one is gone. It runs before render_preprocess applies the dirty rect.
+function efk_sys:update_system_properties()
+    local shown = w:first "efk_visible" ~= nil
+    if shown or efk_shown then
+        idr.full_redraw()
+    end
+    efk_shown = shown
+end
+
 function efk_sys:render_submit()
     local dl        = w:first "directional_light light:in scene:in"
     if dl then
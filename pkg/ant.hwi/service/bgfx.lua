@@ -57,6 +57,7 @@ local profile_printtext = {n=0}
 
 local bgfx_stat = {}
 local views = {}
+local view_names = {}
 
 local PROFILE_SHOW_STATE = {
     fps = true,
@@ -72,6 +73,7 @@ local function stats_views()
     for i = 1, #stats.view do
         local s = stats.view[i]
         local name = s.name
+        view_names[s.view] = name
         local v = views[name]
         if mark[s.name] then
             v.cpu = v.cpu + s.cpu
@@ -144,16 +146,35 @@ local function profile_print()
                 break
             end
         end
-        views = {}
 
         add_text "--- submit"
         add_text(format_text("draw|blit|compute|gpuLatency", (" | %d %d %d %dms"):format(bgfx_stat.numDraw, bgfx_stat.numBlit, bgfx_stat.numCompute, bgfx_stat.maxGpuLatency)))
         local rs = require "render.stat"
         local ss = rs.submit_stat()
-        if next(ss) then
-            add_text(format_text("simple|hitch|efk", (" | %d %d %d"):format(ss.simple_submit, ss.hitch_submit, ss.efk_hitch_submit)))
-            add_text(format_text("hitch_count", (" | %d"):format(ss.hitch_count)))
+        local objs, hitchs = ss.objects, ss.hitchs
+        if objs and hitchs then
+            add_text(format_text("objects num|max|cap", (" | %d %d %d"):format(objs.num, objs.highwater, objs.capacity)))
+            add_text(format_text("hitchs num|max|cap", (" | %d %d %d"):format(hitchs.num, hitchs.highwater, hitchs.capacity)))
+            add_text(format_text("collect|replay", (" | %.02fms %s"):format(ss.collect_ns / 1e6, ss.replay and "yes" or "no")))
         end
+        if ss.queues then
+            local hit, miss = 0, 0
+            for _, q in ipairs(ss.queues) do
+                hit, miss = hit + q.cache_hit, miss + q.cache_miss
+            end
+            local total = hit + miss
+            add_text(format_text("transform cache hit|cap", (" | %.01f%% %d"):format(total > 0 and hit * 100 / total or 0, ss.cache_capacity)))
+            add_text(format_text("queue", " | draw inst vis cull miss tf hit/miss cpu | view gpu cpu"))
+            for _, q in ipairs(ss.queues) do
+                local name = view_names[q.viewid] or ("view%d"):format(q.viewid)
+                local v = views[name]
+                add_text(format_text(("%s(%d)"):format(name, q.queue_index), (" | %d %d %d %d %d %d %d/%d %.02fms | %.02fms %.02fms"):format(
+                    q.draws, q.instanced, q.visible, q.culled, q.material_missing,
+                    q.transforms, q.cache_hit, q.cache_miss, q.submit_ns / 1e6,
+                    v and v.gpu / MaxFrame or 0, v and v.cpu / MaxFrame or 0)))
+            end
+        end
+        views = {}
     end
     for i = 1, profile_printtext.n do
         S.dbg_text_print(0, 2+MaxText+i, 0x02, profile_printtext[i])
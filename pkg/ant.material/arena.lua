@@ -63,4 +63,24 @@ function M.material_load(name, state, stencil, prog, system, attrib)
 	return m
 end
 
+-- move the uniform values together to give back the memory of released materials
+function M.compact()
+	arena.compact(M._arena)
+end
+
+-- attrib/vec count, free slots, capacity and memory in bytes of the arena
+function M.stat()
+	return arena.stat(M._arena)
+end
+
+-- increased whenever a material instance changes its attribs, state or stencil
+function M.version()
+	return arena.version(M._arena)
+end
+
+-- im is the draw indirect variant of m, render submit can merge m into instanced draw call with it
+function M.material_instanced(m, im)
+	arena.instanced(m, im)
+end
+
 return M
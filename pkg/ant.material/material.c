@@ -28,18 +28,89 @@ struct material {
 	uint64_t				global[MATERIAL_SYSTEM_ATTRIB_CHUNK];
 	attrib_id				attrib;
 	int 					prog;
+	struct material			*instanced;	// draw indirect variant, use i_data0~2 as world matrix
+	int						attrib_n;
+	int						global_n;
+	int						ids[];		// packed attribs and then system attribs, applied in one pass
+};
+
+// packed attribs of a patched instance, rebuilt when the patch list changes.
+// content is the serialized values of the attribs (no system attribs), to find identical instances.
+struct attrib_block {
+	int			n;
+	uint32_t	sz;
+	uint64_t	hash;
+	uint8_t		*content;
+	int			ids[];
 };
 
 struct material_instance {
 	struct material *m;
 	struct material_state patch_state;
 	attrib_id patch_attrib;
+	struct attrib_block *block;	// NULL when it's not patched, use the ids of the material
 };
 
+static int
+larena_gc(lua_State *L) {
+	struct attrib_arena *A = (struct attrib_arena *)lua_touserdata(L, 1);
+	attrib_arena_release(A);
+	return 0;
+}
+
 static int
 larena_new(lua_State *L) {
 	struct attrib_arena *A = (struct attrib_arena *)lua_newuserdatauv(L, attrib_arena_size(), 0);
 	attrib_arena_init(A);
+	if (luaL_newmetatable(L, "ANT_ATTRIB_ARENA")) {
+		lua_pushcfunction(L, larena_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+// 1: arena
+static int
+larena_compact(lua_State *L) {
+	struct attrib_arena *A = (struct attrib_arena *)luaL_checkudata(L, 1, "ANT_ATTRIB_ARENA");
+	const char *err = attrib_arena_compact(A);
+	if (err)
+		return luaL_error(L, "Compact arena error : %s", err);
+	return 0;
+}
+
+// 1: arena
+// ret: version of material instances, see attrib_arena_touch
+static int
+larena_version(lua_State *L) {
+	struct attrib_arena *A = (struct attrib_arena *)luaL_checkudata(L, 1, "ANT_ATTRIB_ARENA");
+	lua_pushinteger(L, (lua_Integer)attrib_arena_version(A));
+	return 1;
+}
+
+// 1: arena
+// ret: table of memory statistics
+static int
+larena_stat(lua_State *L) {
+	struct attrib_arena *A = (struct attrib_arena *)luaL_checkudata(L, 1, "ANT_ATTRIB_ARENA");
+	struct attrib_arena_stat stat;
+	attrib_arena_stat(A, &stat);
+	lua_createtable(L, 0, 7);
+	lua_pushinteger(L, stat.attrib);
+	lua_setfield(L, -2, "attrib");
+	lua_pushinteger(L, stat.attrib_free);
+	lua_setfield(L, -2, "attrib_free");
+	lua_pushinteger(L, stat.attrib_capacity);
+	lua_setfield(L, -2, "attrib_capacity");
+	lua_pushinteger(L, stat.vec);
+	lua_setfield(L, -2, "vec");
+	lua_pushinteger(L, stat.vec_free);
+	lua_setfield(L, -2, "vec_free");
+	lua_pushinteger(L, stat.vec_capacity);
+	lua_setfield(L, -2, "vec_capacity");
+	lua_pushinteger(L, (lua_Integer)stat.memory);
+	lua_setfield(L, -2, "memory");
 	return 1;
 }
 
@@ -363,7 +434,30 @@ fetch_system_attrib_set(lua_State *L, int index, uint64_t *set) {
 		--id;
 		int idx = id / 64;
 		int shift = id % 64;
-		set[idx] |= (uint64_t)(1 << shift);
+		set[idx] |= (uint64_t)1 << shift;
+	}
+}
+
+static inline int
+popcount64(uint64_t x) {
+	int n = 0;
+	while (x) {
+		x &= x - 1;
+		++n;
+	}
+	return n;
+}
+
+// system attrib i (base 0) is id -i-1 in arena
+static void
+pack_global(const uint64_t global[MATERIAL_SYSTEM_ATTRIB_CHUNK], int *ids) {
+	int i, j;
+	for (i=0;i<MATERIAL_SYSTEM_ATTRIB_CHUNK;i++) {
+		uint64_t mask = global[i];
+		for (j=0;mask != 0;j++, mask >>= 1) {
+			if (mask & 1)
+				*ids++ = -(i * 64 + j) - 1;
+		}
 	}
 }
 
@@ -374,6 +468,20 @@ compar_int(const void *a, const void *b) {
 	return *aa - *bb;
 }
 
+// free the attribs of the material, the instances of it should be released before
+static int
+lmaterial_release(lua_State *L) {
+	struct material *m = (struct material *)luaL_checkudata(L, 1, "ANT_MATERIAL");
+	attrib_id iter = m->attrib;
+	m->attrib = INVALID_ATTRIB;
+	m->attrib_n = 0;
+	m->global_n = 0;
+	while (iter != INVALID_ATTRIB) {
+		attrib_arena_remove(m->A, &iter);
+	}
+	return 0;
+}
+
 // 1: arena
 // 2: render state (string)
 // 3: stencil (int64)
@@ -385,15 +493,14 @@ static int
 lmaterial_new(lua_State *L) {
 	struct attrib_arena *A = (struct attrib_arena *)lua_touserdata(L, 1);
 	lua_settop(L, 6);
-	struct material *m = (struct material *)lua_newuserdatauv(L, sizeof(*m), 0);
-	m->A = A;
-
-	fetch_material_state(L, 2, &m->state);
-	fetch_material_stencil(L, 3, &m->state);
-	m->prog = (int)luaL_checkinteger(L, 4);
-
 	// base 1 array [1, MATERIAL_SYSTEM_ATTRIB_CHUNK * 64]
-	fetch_system_attrib_set(L, 5, m->global);
+	uint64_t global[MATERIAL_SYSTEM_ATTRIB_CHUNK];
+	fetch_system_attrib_set(L, 5, global);
+	int global_n = 0;
+	int i;
+	for (i=0;i<MATERIAL_SYSTEM_ATTRIB_CHUNK;i++) {
+		global_n += popcount64(global[i]);
+	}
 
 	luaL_checktype(L, 6, LUA_TTABLE);
 	int key[MAX_ATTRIB];
@@ -409,10 +516,29 @@ lmaterial_new(lua_State *L) {
 		++key_n;
 	}
 
-	if (key_n == 0) {
-		m->attrib = INVALID_ATTRIB;
-		return 1;
+	struct material *m = (struct material *)lua_newuserdatauv(L, sizeof(*m) + (key_n + global_n) * sizeof(int), 0);
+	if (luaL_newmetatable(L, "ANT_MATERIAL")) {
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, lmaterial_release);
+		lua_setfield(L, -2, "release");
 	}
+	lua_setmetatable(L, -2);
+	m->A = A;
+	m->instanced = NULL;
+	m->attrib = INVALID_ATTRIB;
+	m->attrib_n = key_n;
+	m->global_n = global_n;
+	memcpy(m->global, global, sizeof(global));
+
+	fetch_material_state(L, 2, &m->state);
+	fetch_material_stencil(L, 3, &m->state);
+	m->prog = (int)luaL_checkinteger(L, 4);
+
+	pack_global(m->global, m->ids + key_n);
+
+	if (key_n == 0)
+		return 1;
 
 	qsort(key, key_n, sizeof(int), compar_int);
 
@@ -420,13 +546,13 @@ lmaterial_new(lua_State *L) {
 
 	int prev = -1;
 
-	int i;
 	for (i=0;i<key_n;i++) {
 		int current = attrib_arena_new(A, prev, key[i]);
 		if (current < 0)
 			return luaL_error(L, "Too many attribs");
 		if (i == 0)
 			m->attrib = (attrib_id)current;
+		m->ids[i] = current;
 		lua_geti(L, 6, key[i]);
 		init_attrib(L, A, current, top);
 		lua_pop(L, 1);
@@ -435,6 +561,21 @@ lmaterial_new(lua_State *L) {
 	return 1;
 }
 
+// 1: material
+// 2: instanced material (draw indirect variant of 1) or nil
+static int
+lmaterial_instanced(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+	struct material *m = (struct material *)lua_touserdata(L, 1);
+	if (lua_isnoneornil(L, 2)) {
+		m->instanced = NULL;
+	} else {
+		luaL_checktype(L, 2, LUA_TUSERDATA);
+		m->instanced = (struct material *)lua_touserdata(L, 2);
+	}
+	return 0;
+}
+
 int
 luaopen_material_arena(lua_State *L) {
 	luaL_checkversion(L);
@@ -442,6 +583,10 @@ luaopen_material_arena(lua_State *L) {
 		{ "arena",			larena_new },
 		{ "system_attrib",  larena_system_attrib},
 		{ "material",       lmaterial_new},
+		{ "instanced",      lmaterial_instanced},
+		{ "compact",        larena_compact},
+		{ "stat",           larena_stat},
+		{ "version",        larena_version},
 		{ NULL, 			NULL },
 	};
 	luaL_newlib(L, l);
@@ -468,6 +613,93 @@ fetch_math_id(lua_State *L, struct ecs_world* w, int index) {
 	return math3d_from_lua_id(L, w->math3d, index);
 }
 
+static inline void
+init_apply_context(struct attrib_arena_apply_context *ctx, struct ecs_world *w) {
+	ctx->bgfx = w->bgfx;
+	ctx->encoder = w->holder ? w->holder->encoder : NULL;
+	ctx->math3d = w->math3d->M;
+	ctx->math_value = math_value;
+	ctx->math_size = math_size;
+	ctx->texture_get = texture_get;
+}
+
+static inline uint64_t
+hash_content(const uint8_t *p, uint32_t sz) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	uint32_t i;
+	for (i=0;i<sz;i++) {
+		h = (h ^ p[i]) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+// serialize the values of the packed attribs into content, return 0 if the size is changed
+static int
+block_write_content(struct attrib_arena *A, struct attrib_block *b, int attrib_n, struct attrib_arena_apply_context *ctx, uint32_t sz) {
+	uint32_t offset = 0;
+	int i;
+	for (i=0;i<attrib_n;i++) {
+		const size_t esz = attrib_arena_content(A, b->ids[i], ctx, b->content + offset, sz - offset);
+		offset += (uint32_t)esz;
+		if (offset > sz)
+			return 0;
+	}
+	if (offset != sz)
+		return 0;
+	b->hash = hash_content(b->content, sz);
+	return 1;
+}
+
+static void
+instance_pack(lua_State *L, struct material_instance *mi) {
+	free(mi->block);
+	mi->block = NULL;
+	if (mi->patch_attrib == INVALID_ATTRIB)
+		return;
+	struct material *m = mi->m;
+	struct attrib_arena *A = m->A;
+	struct attrib_arena_apply_context ctx;
+	init_apply_context(&ctx, getworld(L));
+
+	// patched attribs are always in the material, so the merged list is as long as the material's
+	int ids[MAX_ATTRIB];
+	const int attrib_n = attrib_arena_pack(A, m->attrib, mi->patch_attrib, ids, MAX_ATTRIB);
+	if (attrib_n != m->attrib_n)
+		luaL_error(L, "Invalid patch attribs (%d != %d)", attrib_n, m->attrib_n);
+	size_t sz = 0;
+	int i;
+	for (i=0;i<attrib_n;i++) {
+		sz += attrib_arena_content(A, ids[i], &ctx, NULL, 0);
+	}
+	const int n = attrib_n + m->global_n;
+	struct attrib_block *b = (struct attrib_block *)malloc(sizeof(*b) + n * sizeof(int) + sz);
+	if (b == NULL)
+		luaL_error(L, "Out of memory");
+	b->n = n;
+	b->sz = (uint32_t)sz;
+	b->content = (uint8_t *)(b->ids + n);
+	memcpy(b->ids, ids, attrib_n * sizeof(int));
+	memcpy(b->ids + attrib_n, m->ids + m->attrib_n, m->global_n * sizeof(int));
+	block_write_content(A, b, attrib_n, &ctx, b->sz);
+	mi->block = b;
+}
+
+// the value of a patched attrib is changed, the list is the same
+static void
+instance_update(lua_State *L, struct material_instance *mi) {
+	struct attrib_block *b = mi->block;
+	if (b == NULL) {
+		instance_pack(L, mi);
+		return;
+	}
+	struct attrib_arena_apply_context ctx;
+	init_apply_context(&ctx, getworld(L));
+	if (!block_write_content(mi->m->A, b, mi->m->attrib_n, &ctx, b->sz)) {
+		// size of an instance uniform is changed
+		instance_pack(L, mi);
+	}
+}
+
 static void
 set_attrib(lua_State *L, struct attrib_arena *A, int id, int index) {
 	int t = attrib_arena_type(A, id);
@@ -533,6 +765,7 @@ linstance_set_attrib(lua_State *L) {
 	lua_pop(L, 1);
 	struct material_instance* mi = to_instance(L, 1);
 	struct attrib_arena *A = mi->m->A;
+	attrib_arena_touch(A);
 	attrib_id prev = INVALID_ATTRIB;
 	if (mi->patch_attrib != INVALID_ATTRIB) {
 		attrib_id id = attrib_arena_find(A, mi->patch_attrib, key, &prev);
@@ -543,8 +776,10 @@ linstance_set_attrib(lua_State *L) {
 				if (prev == INVALID_ATTRIB) {
 					mi->patch_attrib = next;
 				}
+				instance_pack(L, mi);
 			} else {
 				set_attrib(L, A, id, 3);
+				instance_update(L, mi);
 			}
 			return 0;
 		}
@@ -563,13 +798,14 @@ linstance_set_attrib(lua_State *L) {
 	if (prev == INVALID_ATTRIB)
 		mi->patch_attrib = patch;
 	set_attrib(L, A, patch, 3);
+	instance_pack(L, mi);
 	return 0;
 }
 
 #define BGFX(api) w->bgfx->api
 
-void
-apply_material_instance(lua_State *L, const struct material_instance *mi, struct ecs_world *w) {
+const char *
+material_instance_apply(const struct material_instance *mi, struct ecs_world *w) {
 	BGFX(encoder_set_state)(w->holder->encoder, 
 		(mi->patch_state.state == 0 ? mi->m->state.state : mi->patch_state.state), 
 		(mi->patch_state.rgba == 0 ? mi->m->state.rgba : mi->patch_state.rgba));
@@ -579,26 +815,26 @@ apply_material_instance(lua_State *L, const struct material_instance *mi, struct
 		(uint32_t)(stencil & 0xffffffff), (uint32_t)(stencil >> 32)
 	);
 
-	struct attrib_arena_apply_context ctx = {
-		w->bgfx,
-		w->holder->encoder,
-		w->math3d->M,
-		math_value,
-		math_size,
-		texture_get,
-	};
+	struct attrib_arena_apply_context ctx;
+	init_apply_context(&ctx, w);
 
-	const char * err = attrib_arena_apply_list(mi->m->A, mi->m->attrib, mi->patch_attrib, &ctx);
-	if (err)
-		luaL_error(L, "Apply error : %s", err);
+	const struct attrib_block *b = mi->block;
+	if (b)
+		return attrib_arena_apply_packed(mi->m->A, b->ids, b->n, &ctx);
+	return attrib_arena_apply_packed(mi->m->A, mi->m->ids, mi->m->attrib_n + mi->m->global_n, &ctx);
+}
 
-	int ii;
-	for (ii = 0; ii < MATERIAL_SYSTEM_ATTRIB_CHUNK; ++ii) {
-		err = attrib_arena_apply_global(mi->m->A, mi->m->global[ii], ii * 64, &ctx);
-		if (err)
-			luaL_error(L, "Apply global error : %s", err);
-	}
+const char *
+material_instance_apply_instanced(const struct material_instance *mi, struct ecs_world *w) {
+	struct material_instance imi = { mi->m->instanced, mi->patch_state, INVALID_ATTRIB, NULL };
+	return material_instance_apply(&imi, w);
+}
 
+void
+apply_material_instance(lua_State *L, const struct material_instance *mi, struct ecs_world *w) {
+	const char * err = material_instance_apply(mi, w);
+	if (err)
+		luaL_error(L, "Apply error : %s", err);
 }
 
 static int
@@ -609,9 +845,19 @@ linstance_apply_attrib(lua_State *L) {
 	return 0;
 }
 
+static int
+linstance_gc(lua_State *L) {
+	struct material_instance* mi = to_instance(L, 1);
+	free(mi->block);
+	mi->block = NULL;
+	return 0;
+}
+
 static int
 linstance_release(lua_State *L) {
 	struct material_instance* mi = to_instance(L, 1);
+	free(mi->block);
+	mi->block = NULL;
 	if (mi->patch_attrib == INVALID_ATTRIB)
 		return 0;
 	struct ecs_world * w = getworld(L);
@@ -661,6 +907,7 @@ static int
 linstance_set_state(lua_State *L) {
 	struct material_instance* mi = to_instance(L, 1);
 	fetch_material_state(L, 2, &mi->patch_state);
+	attrib_arena_touch(mi->m->A);
 	return 0;
 }
 
@@ -675,6 +922,7 @@ static int
 linstance_set_stencil(lua_State *L) {
 	struct material_instance* mi = to_instance(L, 1);
 	fetch_material_stencil(L, 2, &mi->patch_state);
+	attrib_arena_touch(mi->m->A);
 	return 0;
 }
 
@@ -695,6 +943,7 @@ static int
 lmaterial_instance(lua_State *L) {
 	struct material_instance * mi = (struct material_instance *)lua_newuserdatauv(L, sizeof(*mi), 0);
 	mi->patch_attrib = INVALID_ATTRIB;
+	mi->block = NULL;
 	mi->patch_state.state = 0;
 	mi->patch_state.stencil = 0;
 	mi->patch_state.rgba = 0;
@@ -719,6 +968,7 @@ lmaterial_instance_init(lua_State *L) {
 		{ "__newindex", 	NULL},
 		{ "__call", 		linstance_apply_attrib},
 		{ "release",		linstance_release},
+		{ "__gc",			linstance_gc},
 //		{ "attribs",		linstance_attribs},
 
 		{ "get_state",		linstance_get_state},
@@ -794,3 +1044,47 @@ material_prog(lua_State *L, const struct material_instance *mi){
 	(void)L;
 	return program_get(mi->m->prog);
 }
+
+static inline int
+is_shared_instance(const struct material_instance *mi) {
+	return mi->patch_attrib == INVALID_ATTRIB;
+}
+
+static inline int
+block_equal(const struct attrib_block *a, const struct attrib_block *b) {
+	if (a == b)
+		return 1;
+	if (a == NULL || b == NULL)
+		return 0;
+	return a->hash == b->hash && a->sz == b->sz && memcmp(a->content, b->content, a->sz) == 0;
+}
+
+// patched instances are the same if the values of their attribs are identical
+int
+material_instance_equal(const struct material_instance *a, const struct material_instance *b) {
+	if (a == b)
+		return 1;
+	return a->m == b->m
+		&& a->patch_state.state == b->patch_state.state
+		&& a->patch_state.stencil == b->patch_state.stencil
+		&& a->patch_state.rgba == b->patch_state.rgba
+		&& block_equal(a->block, b->block);
+}
+
+uint64_t
+material_instance_batchid(const struct material_instance *mi) {
+	const struct material_state *ps = &mi->patch_state;
+	return (uint64_t)(uintptr_t)mi->m
+		^ (ps->state * 0x9e3779b97f4a7c15ull)
+		^ (ps->stencil * 0xc2b2ae3d27d4eb4full)
+		^ ps->rgba
+		^ (mi->block ? mi->block->hash * 0x165667b19e3779f9ull : 0);
+}
+
+bgfx_program_handle_t
+material_instanced_prog(const struct material_instance *mi) {
+	bgfx_program_handle_t invalid = BGFX_INVALID_HANDLE;
+	if (mi->m->instanced == NULL || !is_shared_instance(mi))
+		return invalid;
+	return program_get(mi->m->instanced->prog);
+}
@@ -2,10 +2,21 @@
 #define _MATERIAL_H_
 
 #include <bgfx/c99/bgfx.h>
+#include <stdint.h>
 
 struct material_instance;
 struct ecs_world;
 struct lua_State;
 void apply_material_instance(struct lua_State *L, const struct material_instance *mi, struct ecs_world *w);
+// same as apply_material_instance, but return the error instead of raising it, it's safe to call outside the lua thread
+const char * material_instance_apply(const struct material_instance *mi, struct ecs_world *w);
 bgfx_program_handle_t material_prog(struct lua_State *L, const struct material_instance *mi);
+
+// instances of the same material without patched attribs are interchangeable, batchid is the same for them
+int material_instance_equal(const struct material_instance *a, const struct material_instance *b);
+uint64_t material_instance_batchid(const struct material_instance *mi);
+
+// instanced variant of the material, invalid handle if the material has no variant or the instance is patched
+bgfx_program_handle_t material_instanced_prog(const struct material_instance *mi);
+const char * material_instance_apply_instanced(const struct material_instance *mi, struct ecs_world *w);
 #endif //_MATERIAL_H_
\ No newline at end of file
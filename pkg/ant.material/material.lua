@@ -12,4 +12,6 @@ function material_init_sys:preinit()
     M.system_attrib_update  = core.system_attrib_update(arena._system, arena._arena)
 end
 
+M.version = arena.version
+
 return M
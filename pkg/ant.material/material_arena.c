@@ -6,13 +6,18 @@
 #include "luabgfx.h"
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 
 #define INVALID_HANDLE 0xffff
 #define MAX_ATTRIB_COUNT 0xffff
-#define MAX_VEC (16 * 1024)
 #define MAX_GLOBAL_COUNT ( MATERIAL_SYSTEM_ATTRIB_CHUNK * 64 )
+#define ATTRIB_CHUNK_SHIFT 10
+#define ATTRIB_CHUNK_SIZE (1 << ATTRIB_CHUNK_SHIFT)
+#define ATTRIB_CHUNK_COUNT ((MAX_ATTRIB_COUNT + ATTRIB_CHUNK_SIZE - 1) / ATTRIB_CHUNK_SIZE)
+#define MIN_VEC 1024
+#define INVALID_VEC (-1)
 
 #if !defined(MATERIAL_DEBUG)
 #define MATERIAL_DEBUG 1
@@ -62,13 +67,28 @@ struct vec {
 	float v[4];
 };
 
+// a free range of vec, stored in its first vec
+struct vec_free {
+	int next;
+	int n;
+};
+
+// attribs are allocated in chunks, so the pointer of an attrib is stable.
+// vecs of an uniform must be continuous, they are in one growable array with a free list of ranges,
+// the index (not the pointer) of a vec is stable until attrib_arena_compact().
 struct attrib_arena {
 	attrib_id freelist;
-	int vec_n;
 	int attrib_n;
-	struct vec v[MAX_VEC];
+	int attrib_free;
+	int chunk_n;
+	int vec_n;			// high water mark of v
+	int vec_cap;
+	int vec_free;		// number of vecs in the free list
+	int vec_freelist;
+	uint64_t version;
+	struct vec *v;
+	attrib_type *a[ATTRIB_CHUNK_COUNT];
 	attrib_type g[MAX_GLOBAL_COUNT];
-	attrib_type a[MAX_ATTRIB_COUNT];
 };
 
 size_t
@@ -79,8 +99,15 @@ attrib_arena_size() {
 void
 attrib_arena_init(struct attrib_arena *A) {
 	A->freelist = INVALID_ATTRIB;
-	A->vec_n = 0;
 	A->attrib_n = 0;
+	A->attrib_free = 0;
+	A->chunk_n = 0;
+	A->vec_n = 0;
+	A->vec_cap = 0;
+	A->vec_free = 0;
+	A->vec_freelist = INVALID_VEC;
+	A->version = 0;
+	A->v = NULL;
 	int i;
 	for (i=0;i<MAX_GLOBAL_COUNT;i++) {
 		A->g[i].h.next = INVALID_ATTRIB;
@@ -89,6 +116,27 @@ attrib_arena_init(struct attrib_arena *A) {
 	}
 }
 
+void
+attrib_arena_touch(struct attrib_arena *A) {
+	++A->version;
+}
+
+uint64_t
+attrib_arena_version(struct attrib_arena *A) {
+	return A->version;
+}
+
+void
+attrib_arena_release(struct attrib_arena *A) {
+	int i;
+	for (i=0;i<A->chunk_n;i++) {
+		free(A->a[i]);
+		A->a[i] = NULL;
+	}
+	free(A->v);
+	attrib_arena_init(A);
+}
+
 static inline attrib_type *
 get_attrib_from_id(struct attrib_arena *A, int id) {
 	if (id < 0) {
@@ -97,16 +145,84 @@ get_attrib_from_id(struct attrib_arena *A, int id) {
 			return NULL;
 		return &A->g[id];
 	} else {
-		if (id >= MAX_ATTRIB_COUNT)
+		if (id >= A->attrib_n)
 			return NULL;
-		return &A->a[id];
+		return &A->a[id >> ATTRIB_CHUNK_SHIFT][id & (ATTRIB_CHUNK_SIZE - 1)];
 	}
 }
 
 static inline attrib_type *
 get_attrib(struct attrib_arena *A, attrib_id id) {
-	assert(id < MAX_ATTRIB_COUNT);
-	return &A->a[id];
+	assert(id < A->attrib_n);
+	return &A->a[id >> ATTRIB_CHUNK_SHIFT][id & (ATTRIB_CHUNK_SIZE - 1)];
+}
+
+static inline struct vec_free *
+vec_free_node(struct attrib_arena *A, int index) {
+	return (struct vec_free *)A->v[index].v;
+}
+
+// first fit in the free list, or grow the array
+static int
+vec_alloc(struct attrib_arena *A, int n) {
+	int prev = INVALID_VEC;
+	int index = A->vec_freelist;
+	while (index != INVALID_VEC) {
+		struct vec_free *f = vec_free_node(A, index);
+		if (f->n >= n) {
+			A->vec_free -= n;
+			if (f->n == n) {
+				if (prev == INVALID_VEC)
+					A->vec_freelist = f->next;
+				else
+					vec_free_node(A, prev)->next = f->next;
+				return index;
+			}
+			// take the tail of the range
+			f->n -= n;
+			return index + f->n;
+		}
+		prev = index;
+		index = f->next;
+	}
+	if (A->vec_n + n > A->vec_cap) {
+		int cap = A->vec_cap < MIN_VEC ? MIN_VEC : A->vec_cap;
+		while (cap < A->vec_n + n)
+			cap *= 2;
+		struct vec *v = (struct vec *)realloc(A->v, cap * sizeof(struct vec));
+		if (v == NULL)
+			return INVALID_VEC;
+		A->v = v;
+		A->vec_cap = cap;
+	}
+	index = A->vec_n;
+	A->vec_n += n;
+	return index;
+}
+
+static void
+vec_dealloc(struct attrib_arena *A, int index, int n) {
+	if (n <= 0)
+		return;
+	if (index + n == A->vec_n) {
+		A->vec_n = index;
+		return;
+	}
+	struct vec_free *f = vec_free_node(A, index);
+	f->next = A->vec_freelist;
+	f->n = n;
+	A->vec_freelist = index;
+	A->vec_free += n;
+}
+
+// release the storage of the attrib which is moved into the free list
+static void
+free_attrib(struct attrib_arena *A, attrib_type *a) {
+	if (a->h.type == ATTRIB_UNIFORM) {
+		vec_dealloc(A, a->u.u.v.vec, a->u.u.v.n);
+	}
+	a->h.type = ATTRIB_NONE;
+	++A->attrib_free;
 }
 
 const char *
@@ -115,15 +231,15 @@ attrib_arena_init_uniform(struct attrib_arena *A, int id, bgfx_uniform_handle_t
 	if (a == NULL)
 		return "Invalid attrib id";
 	if (a->h.type == ATTRIB_NONE) {
-		if (A->vec_n + n > MAX_VEC) {
-			return "Too many vec for attribs";
+		const int vec = vec_alloc(A, n);
+		if (vec == INVALID_VEC) {
+			return "Out of memory for attrib vecs";
 		}
 		// init
 		a->h.type = ATTRIB_UNIFORM;
-		a->u.u.v.vec = A->vec_n;
+		a->u.u.v.vec = vec;
 		a->u.u.v.n = n;
 		a->u.u.v.elem = elem;
-		A->vec_n += n;
 	} else {
 		if (a->h.type != ATTRIB_UNIFORM)
 			return "Invalid attrib type UNIFORM";
@@ -203,11 +319,21 @@ attrib_arena_new(struct attrib_arena *A, attrib_id prev, name_id key) {
 	attrib_id r = A->freelist;
 	if (r != INVALID_ATTRIB) {
 		A->freelist = get_attrib(A, r)->h.next;
+		--A->attrib_free;
 		return init_attrib(A, prev, r, key);
 	}
-	r = A->attrib_n++;
-	if (r >= MAX_ATTRIB_COUNT)
+	if (A->attrib_n >= MAX_ATTRIB_COUNT)
 		return INVALID_ATTRIB;
+	r = A->attrib_n;
+	const int chunk = r >> ATTRIB_CHUNK_SHIFT;
+	if (chunk >= A->chunk_n) {
+		attrib_type *c = (attrib_type *)malloc(ATTRIB_CHUNK_SIZE * sizeof(attrib_type));
+		if (c == NULL)
+			return INVALID_ATTRIB;
+		A->a[chunk] = c;
+		A->chunk_n = chunk + 1;
+	}
+	++A->attrib_n;
 	return init_attrib(A, prev, r, key);
 }
 
@@ -219,6 +345,7 @@ attrib_arena_delete(struct attrib_arena *A, attrib_id prev, attrib_id current) {
 		attrib_type *p = get_attrib(A, prev);
 		p->h.next = next;
 	}
+	free_attrib(A, a);
 	a->h.next = A->freelist;
 	A->freelist = current;
 	return next;
@@ -456,67 +583,95 @@ get_next_attrib(struct attrib_arena *A, attrib_id *id1, attrib_id *id2) {
 	return get_next(A, id2);
 }
 
-const char *
-attrib_arena_apply_list(struct attrib_arena *A, attrib_id head, attrib_id patch, struct attrib_arena_apply_context *ctx) {
+int
+attrib_arena_pack(struct attrib_arena *A, attrib_id head, attrib_id patch, int *ids, int n) {
+	int count = 0;
 	attrib_id id;
 	while ((id = get_next_attrib(A, &patch, &head)) != INVALID_ATTRIB) {
-		const char * err = attrib_arena_apply(A, id, ctx);
-		if (err)
-			return err;
+		if (count >= n)
+			return -1;
+		ids[count++] = id;
 	}
-	return NULL;
+	return count;
 }
 
-static inline const char *
-apply_global8(struct attrib_arena *A, uint8_t mask, int base, struct attrib_arena_apply_context *ctx) {
+const char *
+attrib_arena_apply_packed(struct attrib_arena *A, const int *ids, int n, struct attrib_arena_apply_context *ctx) {
 	int i;
-	int id = -base-1;
-	for (i=0;mask != 0 && i<8;i++) {
-		if (mask & 1) {
-			const char * err = attrib_arena_apply(A, id, ctx);
-			if (err)
-				return err;
-		}
-		mask >>= 1;
-		--id;
+	for (i=0;i<n;i++) {
+		const char * err = attrib_arena_apply(A, ids[i], ctx);
+		if (err)
+			return err;
 	}
 	return NULL;
 }
 
-static inline const char *
-apply_global16(struct attrib_arena *A, uint16_t mask, int base, struct attrib_arena_apply_context *ctx) {
-	if (mask == 0)
+// uniform value of the attrib, instance uniform is read from math3d
+static inline const float *
+uniform_value(struct attrib_arena *A, attrib_type *a, struct attrib_arena_apply_context *ctx, int *n) {
+	if (a->h.type == ATTRIB_UNIFORM) {
+		*n = a->u.u.v.n;
+		return A->v[a->u.u.v.vec].v;
+	}
+	if (math_isnull(a->u.u.m)) {
+		*n = 0;
 		return NULL;
-	uint8_t mask8[2] = { mask & 0xff, mask >> 8 };
-	const char * err = apply_global8(A, mask8[0], base, ctx);
-	if (err)
-		return err;
-	err = apply_global8(A, mask8[1], base + 8, ctx);
-	return err;
+	}
+	*n = ctx->math_size(ctx->math3d, a->u.u.m);
+	return ctx->math_value(ctx->math3d, a->u.u.m);
 }
 
-static inline const char *
-apply_global32(struct attrib_arena *A, uint32_t mask, int base, struct attrib_arena_apply_context *ctx) {
-	if (mask == 0)
-		return NULL;
-	uint16_t mask16[2] = { mask & 0xffff, mask >> 16 };
-	const char * err = apply_global16(A, mask16[0], base, ctx);
-	if (err)
-		return err;
-	err = apply_global16(A, mask16[1], base + 16, ctx);
-	return err;
+struct content_writer {
+	uint8_t *ptr;
+	size_t sz;
+	size_t cap;
+};
+
+static inline void
+content_write(struct content_writer *cw, const void *data, size_t sz) {
+	if (cw->sz + sz <= cw->cap)
+		memcpy(cw->ptr + cw->sz, data, sz);
+	cw->sz += sz;
 }
 
-const char *
-attrib_arena_apply_global(struct attrib_arena *A, uint64_t mask, int base, struct attrib_arena_apply_context *ctx) {
-	if (mask == 0)
-		return NULL;
-	uint32_t mask32[2] = { mask & 0xffffffff , mask >> 32 };
-	const char * err = apply_global32(A, mask32[0], base, ctx);
-	if (err)
-		return err;
-	err = apply_global32(A, mask32[1], base + 32, ctx);
-	return err;
+size_t
+attrib_arena_content(struct attrib_arena *A, int id, struct attrib_arena_apply_context *ctx, void *buffer, size_t sz) {
+	attrib_type *a = get_attrib_from_id(A, id);
+	if (a == NULL)
+		return 0;
+	struct content_writer cw = { (uint8_t *)buffer, 0, buffer ? sz : 0 };
+	// instance uniform has the same content as the uniform it's cloned from
+	const uint8_t type = a->h.type == ATTRIB_UNIFORM_INSTANCE ? ATTRIB_UNIFORM : a->h.type;
+	content_write(&cw, &a->h.key, sizeof(a->h.key));
+	content_write(&cw, &type, sizeof(type));
+	switch (a->h.type) {
+	case ATTRIB_UNIFORM:
+	case ATTRIB_UNIFORM_INSTANCE: {
+		int n;
+		const float *v = uniform_value(A, a, ctx, &n);
+		const uint16_t nn = (uint16_t)n;
+		content_write(&cw, &a->u.handle.idx, sizeof(a->u.handle.idx));
+		content_write(&cw, &nn, sizeof(nn));
+		if (v)
+			content_write(&cw, v, n * sizeof(struct vec));
+		break;
+	}
+	case ATTRIB_SAMPLER:
+		content_write(&cw, &a->u.handle.idx, sizeof(a->u.handle.idx));
+		content_write(&cw, &a->u.u.t.handle, sizeof(a->u.u.t.handle));
+		content_write(&cw, &a->u.u.t.stage, sizeof(a->u.u.t.stage));
+		break;
+	case ATTRIB_IMAGE:
+	case ATTRIB_BUFFER:
+		content_write(&cw, &a->r.handle, sizeof(a->r.handle));
+		content_write(&cw, &a->r.stage, sizeof(a->r.stage));
+		content_write(&cw, &a->r.mip, sizeof(a->r.mip));
+		content_write(&cw, &a->r.access, sizeof(a->r.access));
+		break;
+	default:
+		break;
+	}
+	return cw.sz;
 }
 
 math_t
@@ -531,14 +686,65 @@ attrib_arena_remove(struct attrib_arena *A, attrib_id *prev) {
 	}
 	*prev = a->h.next;
 
+	math_t m = a->h.type == ATTRIB_UNIFORM_INSTANCE ? a->u.u.m : MATH_NULL;
+	free_attrib(A, a);
 	a->h.next = A->freelist;
 	A->freelist = current;
+	return m;
+}
 
-	if (a->h.type == ATTRIB_UNIFORM_INSTANCE) {
-		return a->u.u.m;
-	} else {
-		return MATH_NULL;
+static void
+compact_uniform(struct vec *v, int *n, attrib_type *a, const struct vec *from) {
+	if (a->h.type != ATTRIB_UNIFORM)
+		return;
+	memcpy(v + *n, from + a->u.u.v.vec, a->u.u.v.n * sizeof(struct vec));
+	a->u.u.v.vec = *n;
+	*n += a->u.u.v.n;
+}
+
+const char *
+attrib_arena_compact(struct attrib_arena *A) {
+	const int used = A->vec_n - A->vec_free;
+	struct vec *v = NULL;
+	int cap = 0;
+	if (used > 0) {
+		cap = MIN_VEC;
+		while (cap < used)
+			cap *= 2;
+		v = (struct vec *)malloc(cap * sizeof(struct vec));
+		if (v == NULL)
+			return "Out of memory for attrib vecs";
+	}
+	int n = 0;
+	int i;
+	for (i=0;i<MAX_GLOBAL_COUNT;i++) {
+		compact_uniform(v, &n, &A->g[i], A->v);
+	}
+	// attribs in the free list are ATTRIB_NONE
+	for (i=0;i<A->attrib_n;i++) {
+		compact_uniform(v, &n, get_attrib(A, (attrib_id)i), A->v);
 	}
+	assert(n == used);
+	free(A->v);
+	A->v = v;
+	A->vec_n = n;
+	A->vec_cap = cap;
+	A->vec_free = 0;
+	A->vec_freelist = INVALID_VEC;
+	return NULL;
+}
+
+void
+attrib_arena_stat(struct attrib_arena *A, struct attrib_arena_stat *stat) {
+	stat->attrib = A->attrib_n - A->attrib_free;
+	stat->attrib_free = A->attrib_free;
+	stat->attrib_capacity = A->chunk_n * ATTRIB_CHUNK_SIZE;
+	stat->vec = A->vec_n - A->vec_free;
+	stat->vec_free = A->vec_free;
+	stat->vec_capacity = A->vec_cap;
+	stat->memory = sizeof(*A)
+		+ (size_t)A->chunk_n * ATTRIB_CHUNK_SIZE * sizeof(attrib_type)
+		+ (size_t)A->vec_cap * sizeof(struct vec);
 }
 
 int
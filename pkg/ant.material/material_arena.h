@@ -22,6 +22,10 @@ struct attrib_arena;
 
 size_t attrib_arena_size();
 void attrib_arena_init(struct attrib_arena *A);
+void attrib_arena_release(struct attrib_arena *A);
+// the version is increased by attrib_arena_touch when an instance changes its attribs or states, system attribs don't touch it
+void attrib_arena_touch(struct attrib_arena *A);
+uint64_t attrib_arena_version(struct attrib_arena *A);
 const char * attrib_arena_init_uniform(struct attrib_arena *A, int id, bgfx_uniform_handle_t h, const float *v, int n, int elem);
 const char * attrib_arena_init_sampler(struct attrib_arena *A, int id, bgfx_uniform_handle_t h, uint32_t handle, uint8_t stage);
 const char * attrib_arena_init_image(struct attrib_arena *A, int id, uint32_t handle, uint8_t stage, bgfx_access_t access, uint8_t mip);
@@ -38,6 +42,20 @@ void attrib_arena_set_sampler(struct attrib_arena *A, int id, uint32_t handle, i
 void attrib_arena_set_resource(struct attrib_arena *A, int id, uint32_t handle, uint8_t stage, bgfx_access_t access, uint8_t mip);
 int attrib_arena_type(struct attrib_arena *A, int id);
 
+struct attrib_arena_stat {
+	int attrib;
+	int attrib_free;
+	int attrib_capacity;
+	int vec;
+	int vec_free;
+	int vec_capacity;
+	size_t memory;
+};
+
+// move all the uniform vecs together and drop the free list, the indices of vec are changed
+const char * attrib_arena_compact(struct attrib_arena *A);
+void attrib_arena_stat(struct attrib_arena *A, struct attrib_arena_stat *stat);
+
 struct attrib_arena_apply_context {
 	struct bgfx_interface_vtbl *bgfx;
 	bgfx_encoder_t *encoder;
@@ -48,7 +66,11 @@ struct attrib_arena_apply_context {
 };
 
 const char * attrib_arena_apply(struct attrib_arena *A, int id, struct attrib_arena_apply_context *ctx);
-const char * attrib_arena_apply_list(struct attrib_arena *A, attrib_id head, attrib_id patch, struct attrib_arena_apply_context *ctx);
-const char * attrib_arena_apply_global(struct attrib_arena *A, uint64_t mask, int base, struct attrib_arena_apply_context *ctx);
+// merge the attrib list and its patch list into ids (patched attribs override), return the count or -1 if ids is too small
+int attrib_arena_pack(struct attrib_arena *A, attrib_id head, attrib_id patch, int *ids, int n);
+const char * attrib_arena_apply_packed(struct attrib_arena *A, const int *ids, int n, struct attrib_arena_apply_context *ctx);
+// serialize the value of an attrib into buffer for comparing, return the bytes needed (nothing written if sz is not enough)
+// only math3d of ctx is used
+size_t attrib_arena_content(struct attrib_arena *A, int id, struct attrib_arena_apply_context *ctx, void *buffer, size_t sz);
 
 #endif
@@ -18,6 +18,7 @@ struct render_material {
 	int freelist;
 	int n;
 	int cap;
+	uint64_t version;
 	struct material_tuple *arena;
 };
 
@@ -48,7 +49,7 @@ highest_bit(uint64_t xx) {
 void
 render_material_fetch(struct render_material *R, int index, uint64_t mask, void *mat[]) {
 	int h = highest_bit(mask);
-	memset(mat, 0, h * sizeof(void *));
+	memset(mat, 0, (h + 1) * sizeof(void *));
 	assert(index < R->n);
 	struct material_tuple * m = &R->arena[index];
 	for (;;) {
@@ -68,6 +69,44 @@ render_material_fetch(struct render_material *R, int index, uint64_t mask, void
 	}
 }
 
+static inline int
+popcount64(uint64_t x) {
+	int n = 0;
+	while (x) {
+		x &= x - 1;
+		++n;
+	}
+	return n;
+}
+
+void
+render_material_fetch_compact(struct render_material *R, int index, uint64_t mask, void *mat[]) {
+	memset(mat, 0, popcount64(mask) * sizeof(void *));
+	assert(index < R->n);
+	struct material_tuple * m = &R->arena[index];
+	// types are sorted in the chain, so the slot of a type is the count of the types found before it
+	uint64_t found = 0;
+	for (;;) {
+		int i;
+		for (i=0;i<TUPLE_N;i++) {
+			uint8_t t = m->type[i];
+			if (t >= RENDER_MATERIAL_TYPE_MAX) {
+				return;
+			}
+			const uint64_t bit = 1ull << t;
+			if (mask & bit) {
+				mat[popcount64(mask & (bit - 1))] = m->mat[i];
+				found |= bit;
+				if (found == mask)
+					return;
+			}
+		}
+		if (m->next < 0)
+			return;
+		m = &R->arena[m->next];
+	}
+}
+
 struct render_material *
 render_material_create() {
 	struct render_material *R = (struct render_material *)malloc(sizeof(*R));
@@ -91,6 +130,11 @@ render_material_newtype(struct render_material *R) {
 	return t;
 }
 
+uint64_t
+render_material_version(struct render_material *R) {
+	return R->version;
+}
+
 size_t
 render_material_memsize(struct render_material *R) {
 	return sizeof(*R) + sizeof(struct material_tuple) * R->cap;
@@ -156,8 +200,17 @@ expand_chunk(struct render_material *R, struct material_chunk *C, int n) {
 	if (n % TUPLE_N != 0 || n == 0)
 		return;
 	assert(n < RENDER_MATERIAL_TYPE_MAX);
-	int node = allocnode(R);
 	int last = (n - 1) / TUPLE_N;
+	// allocnode may realloc the arena, keep the chunks by index
+	int index[MAX_CHUNK];
+	int i;
+	for (i=0;i<=last;i++) {
+		index[i] = (int)(C->c[i] - R->arena);
+	}
+	int node = allocnode(R);
+	for (i=0;i<=last;i++) {
+		C->c[i] = &R->arena[index[i]];
+	}
 	C->c[last]->next = node;
 	C->c[last+1] = &R->arena[node];
 	C->c[last+1]->next = -1;
@@ -172,6 +225,7 @@ close_chunk(struct material_chunk *C, int n) {
 
 void
 render_material_set(struct render_material *R, int index, int type, void *mat) {
+	++R->version;
 	struct material_chunk C;
 	int n = fetch_chunk(R, index, &C);
 	int i;
@@ -223,6 +277,7 @@ render_material_set(struct render_material *R, int index, int type, void *mat) {
 
 int
 render_material_alloc(struct render_material *R) {
+	++R->version;
 	int index = allocnode(R);
 	struct material_tuple *node = &R->arena[index];
 	node->next = -1;
@@ -232,6 +287,7 @@ render_material_alloc(struct render_material *R) {
 
 void
 render_material_dealloc(struct render_material *R, int index) {
+	++R->version;
 	while (index >= 0) {
 		struct material_tuple *node = &R->arena[index];
 		int next = node->next;
@@ -10,8 +10,12 @@ struct render_material;
 struct render_material * render_material_create();
 void render_material_release(struct render_material *R);
 void render_material_fetch(struct render_material *R, int index, uint64_t mask, void *mat[]);
+// mat[k] is the material of the k-th lowest type in mask, NULL if it's not set, one walk for all types
+void render_material_fetch_compact(struct render_material *R, int index, uint64_t mask, void *mat[]);
 int render_material_newtype(struct render_material *R);
 size_t render_material_memsize(struct render_material *R);
+// increased by every set/alloc/dealloc, so a change of any render material can be detected
+uint64_t render_material_version(struct render_material *R);
 int render_material_alloc(struct render_material *R);
 void render_material_dealloc(struct render_material *R, int index);
 void render_material_set(struct render_material *R, int index, int type, void *mat);
@@ -1,14 +1,10 @@
 local lm = require "luamake"
 
 lm:lua_source "motion_sampler" {
-    deps = {
-        "ozz-animation-runtime",
-    },
     includes = {
         lm.AntDir .. "/3rd/math3d",
         --lm.AntDir .. "/3rd/glm",
         lm.AntDir .. "/3rd/luaecs",
-        lm.AntDir .. "/3rd/ozz-animation/include",
         lm.AntDir .. "/clibs/ecs",
     },
     sources = {
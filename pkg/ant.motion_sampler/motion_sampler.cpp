@@ -5,33 +5,118 @@
 #include "tween.h"
 #include "mathid.h"
 
-#include "ozz/animation/runtime/track_sampling_job.h"
-#include "ozz/animation/offline/raw_track.h"
-#include "ozz/animation/offline/track_builder.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define MOTION_SIMD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define MOTION_SIMD_NEON
+#endif
 
 extern "C"{
 	#include "math3d.h"
 	#include "math3dfunc.h"
 }
 
+struct alignas(16) motion_value {
+	float v[4];
+};
+
+struct motion_range {
+	uint32_t offset;
+	uint32_t count;
+};
+
+// keyframes of all the motion tracks, ratios and values are kept in separate streams,
+// so the key search only touches the ratios
+struct motion_pool {
+	std::vector<float>			ratios;
+	std::vector<motion_value>	values;
+	// sorted by offset, adjacent ranges are merged
+	std::vector<motion_range>	freelist;
+
+	uint32_t alloc(uint32_t n){
+		for (auto it = freelist.begin(); it != freelist.end(); ++it){
+			if (it->count >= n){
+				const uint32_t offset = it->offset;
+				it->offset += n;
+				it->count -= n;
+				if (it->count == 0)
+					freelist.erase(it);
+				return offset;
+			}
+		}
+		const uint32_t offset = (uint32_t)ratios.size();
+		ratios.resize(offset + n);
+		values.resize(offset + n);
+		return offset;
+	}
+
+	void dealloc(uint32_t offset, uint32_t count){
+		if (count == 0)
+			return;
+		auto it = std::lower_bound(freelist.begin(), freelist.end(), offset, [](const motion_range &r, uint32_t o){ return r.offset < o; });
+		it = freelist.insert(it, motion_range{offset, count});
+		auto next = it + 1;
+		if (next != freelist.end() && it->offset + it->count == next->offset){
+			it->count += next->count;
+			freelist.erase(next);
+		}
+		if (it != freelist.begin()){
+			auto prev = it - 1;
+			if (prev->offset + prev->count == it->offset){
+				prev->count += it->count;
+				it = freelist.erase(it) - 1;
+			}
+		}
+		// give the tail back
+		if (it->offset + it->count == (uint32_t)ratios.size()){
+			ratios.resize(it->offset);
+			values.resize(it->offset);
+			freelist.erase(it);
+		}
+	}
+};
+
+static motion_pool g_pool;
+
+// count == 0 means the channel is not animated
+struct motion_channel {
+	uint32_t offset = 0;
+	uint32_t count = 0;
+};
 
 struct motion_tracks {
-	ozz::unique_ptr<ozz::animation::Float3Track>		s;
-	ozz::unique_ptr<ozz::animation::QuaternionTrack>	r;
-	ozz::unique_ptr<ozz::animation::Float3Track>		t;
+	motion_channel s;
+	motion_channel r;
+	motion_channel t;
+
+	~motion_tracks(){
+		for (auto c : {s, r, t}){
+			g_pool.dealloc(c.offset, c.count);
+		}
+	}
 };
 
-struct motion_keyframe {
-	ozz::animation::offline::RawFloat3Track::Keyframe		s;
-	ozz::animation::offline::RawQuaternionTrack::Keyframe	r;
-	ozz::animation::offline::RawFloat3Track::Keyframe		t;
+struct motion_key {
+	float			ratio;
+	motion_value	value;
 };
 
-static inline motion_keyframe
-extract_keyframe(lua_State *L, int index, ecs_world* w){
-	luaL_checktype(L, index, LUA_TTABLE);
+struct motion_keyframes {
+	std::vector<motion_key> s, r, t;
+};
 
-	motion_keyframe kf;
+static void
+pull_keyframes(lua_State *L, int index, ecs_world* w, motion_keyframes &kfs){
+	luaL_checktype(L, index, LUA_TTABLE);
 
 	//step
 	const int steptype = lua_getfield(L, index, "step");
@@ -41,58 +126,181 @@ extract_keyframe(lua_State *L, int index, ecs_world* w){
 	const float step = (float)lua_tonumber(L, -1);
 	lua_pop(L, 1);
 
-	auto pull_keyframe = [L, w, step](int index, const char* name, auto& keyframe){
+	auto pull_keyframe = [L, w, step](int index, const char* name, std::vector<motion_key> &keys, int n){
 		const int st = lua_getfield(L, index, name);
 		if (st != LUA_TNIL){
 			const math_t s = math3d_from_lua_id(L, w->math3d, -1);
 			if (!math_valid(w->math3d->M, s)){
 				luaL_error(L, "Invalid '%s' data: %d", name, index);
 			}
-
-			const float *sv = math_value(w->math3d->M, s);
-			keyframe.interpolation = ozz::animation::offline::RawTrackInterpolation::kLinear;
-			keyframe.ratio = step;
-
-			using ValueType = decltype(keyframe.value);
-			keyframe.value = *((ValueType*)sv);
-		} else {
-			keyframe.ratio = -1.f;
+			motion_key k{ std::clamp(step, 0.f, 1.f), {{0.f, 0.f, 0.f, 0.f}} };
+			memcpy(k.value.v, math_value(w->math3d->M, s), n * sizeof(float));
+			keys.push_back(k);
 		}
 		lua_pop(L, 1);
 	};
 
-	pull_keyframe(index, "s", kf.s);
-	pull_keyframe(index, "r", kf.r);
-	pull_keyframe(index, "t", kf.t);
+	pull_keyframe(index, "s", kfs.s, 3);
+	pull_keyframe(index, "r", kfs.r, 4);
+	pull_keyframe(index, "t", kfs.t, 3);
+}
 
-	return kf;
+static void
+build_channel(motion_channel &c, std::vector<motion_key> &keys, bool quat){
+	g_pool.dealloc(c.offset, c.count);
+	c = motion_channel{};
+	if (keys.empty())
+		return;
+
+	std::stable_sort(keys.begin(), keys.end(), [](const motion_key &a, const motion_key &b){ return a.ratio < b.ratio; });
+	c.count = (uint32_t)keys.size();
+	c.offset = g_pool.alloc(c.count);
+	for (uint32_t ii=0; ii<c.count; ++ii){
+		motion_value v = keys[ii].value;
+		if (quat){
+			// normalized, and in the same hemisphere with the previous key for the shortest path
+			float len = 0, dot = 0;
+			for (int jj=0; jj<4; ++jj){
+				len += v.v[jj] * v.v[jj];
+			}
+			const float inv = len > 0 ? 1.f / std::sqrt(len) : 1.f;
+			for (int jj=0; jj<4; ++jj){
+				v.v[jj] *= inv;
+			}
+			if (ii > 0){
+				const motion_value &p = g_pool.values[c.offset + ii - 1];
+				for (int jj=0; jj<4; ++jj){
+					dot += p.v[jj] * v.v[jj];
+				}
+				if (dot < 0){
+					for (int jj=0; jj<4; ++jj){
+						v.v[jj] = -v.v[jj];
+					}
+				}
+			}
+		}
+		g_pool.ratios[c.offset + ii] = keys[ii].ratio;
+		g_pool.values[c.offset + ii] = v;
+	}
 }
 
 static inline void
 build_tracks(lua_State *L, ecs_world *w, int index, motion_tracks *mt){
 	luaL_checktype(L, index, LUA_TTABLE);
 	const int n = (int)lua_rawlen(L, index);
-	
-	ozz::animation::offline::RawFloat3Track s_tracks, t_tracks;
-	ozz::animation::offline::RawQuaternionTrack r_tracks;
+
+	motion_keyframes kfs;
 	for (int i=0; i<n; ++i){
 		lua_geti(L, index, i+1);
-		const motion_keyframe kf = extract_keyframe(L, -1, w);
+		pull_keyframes(L, -1, w, kfs);
 		lua_pop(L, 1);
+	}
+	build_channel(mt->s, kfs.s, false);
+	build_channel(mt->r, kfs.r, true);
+	build_channel(mt->t, kfs.t, false);
+}
+
+// number of keys whose ratio <= ratio, ratios are sorted
+static inline uint32_t
+key_count_le(const float *ratios, uint32_t count, float ratio){
+	uint32_t n = 0, ii = 0;
+#if defined(MOTION_SIMD_SSE)
+	const __m128 r = _mm_set1_ps(ratio);
+	for (; ii + 4 <= count; ii += 4){
+		const uint32_t m = (uint32_t)_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(ratios + ii), r));
+		n += (uint32_t)std::popcount(m);
+		if (m != 0xf)
+			return n;
+	}
+#elif defined(MOTION_SIMD_NEON)
+	const float32x4_t r = vdupq_n_f32(ratio);
+	for (; ii + 4 <= count; ii += 4){
+		const uint32x4_t le = vshrq_n_u32(vcleq_f32(vld1q_f32(ratios + ii), r), 31);
+		const uint32x2_t s = vadd_u32(vget_low_u32(le), vget_high_u32(le));
+		const uint32_t c = vget_lane_u32(vpadd_u32(s, s), 0);
+		n += c;
+		if (c != 4)
+			return n;
+	}
+#endif
+	for (; ii < count && ratios[ii] <= ratio; ++ii){
+		++n;
+	}
+	return n;
+}
 
-		if (kf.s.ratio >= 0.f)
-			s_tracks.keyframes.push_back(kf.s);
-		
-		if (kf.r.ratio >= 0.f) 
-			r_tracks.keyframes.push_back(kf.r);
+static inline void
+lerp_value(const motion_value &a, const motion_value &b, float t, motion_value &out){
+#if defined(MOTION_SIMD_SSE)
+	const __m128 va = _mm_load_ps(a.v);
+	_mm_store_ps(out.v, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(b.v), va), _mm_set1_ps(t))));
+#elif defined(MOTION_SIMD_NEON)
+	const float32x4_t va = vld1q_f32(a.v);
+	vst1q_f32(out.v, vmlaq_n_f32(va, vsubq_f32(vld1q_f32(b.v), va), t));
+#else
+	for (int ii=0; ii<4; ++ii){
+		out.v[ii] = a.v[ii] + (b.v[ii] - a.v[ii]) * t;
+	}
+#endif
+}
 
-		if (kf.t.ratio >= 0.f)
-			t_tracks.keyframes.push_back(kf.t);
+// linear for vector, nlerp for quaternion, clamped to the first/last key
+static inline void
+sample_channel(const motion_channel &c, float ratio, bool quat, motion_value &out){
+	const float *rs = g_pool.ratios.data() + c.offset;
+	const motion_value *vs = g_pool.values.data() + c.offset;
+	const uint32_t k = key_count_le(rs, c.count, ratio);
+	if (k == 0){
+		out = vs[0];
+		return;
+	}
+	if (k == c.count){
+		out = vs[c.count-1];
+		return;
+	}
+	// rs[k-1] <= ratio < rs[k]
+	lerp_value(vs[k-1], vs[k], (ratio - rs[k-1]) / (rs[k] - rs[k-1]), out);
+	if (quat){
+		const float len = out.v[0] * out.v[0] + out.v[1] * out.v[1] + out.v[2] * out.v[2] + out.v[3] * out.v[3];
+		const float inv = len > 0 ? 1.f / std::sqrt(len) : 1.f;
+		for (int ii=0; ii<4; ++ii){
+			out.v[ii] *= inv;
+		}
 	}
-	ozz::animation::offline::TrackBuilder builder;
-	mt->s = s_tracks.keyframes.empty() ? nullptr : builder(s_tracks);
-	mt->r = r_tracks.keyframes.empty() ? nullptr : builder(r_tracks);
-	mt->t = t_tracks.keyframes.empty() ? nullptr : builder(t_tracks);
+}
+
+struct motion_job {
+	const motion_tracks *mt;
+	float			ratio;
+	bool			update;
+	motion_value	s, r, t;
+};
+
+static std::vector<motion_job> g_jobs;
+
+static void
+sample_jobs(motion_job *jobs, uint32_t n){
+	for (uint32_t ii=0; ii<n; ++ii){
+		motion_job &j = jobs[ii];
+		if (!j.update)
+			continue;
+		if (j.mt->s.count)
+			sample_channel(j.mt->s, j.ratio, false, j.s);
+		if (j.mt->r.count)
+			sample_channel(j.mt->r, j.ratio, true, j.r);
+		if (j.mt->t.count)
+			sample_channel(j.mt->t, j.ratio, false, j.t);
+	}
+}
+
+// return true if the value is changed
+static inline bool
+write_value(struct math_context *M, math_t &id, const motion_value &v, int type){
+	if (!math_isnull(id) && memcmp(math_value(M, id), v.v, sizeof(v.v)) == 0)
+		return false;
+	math_unmark(M, id);
+	id = math_mark(M, math_import(M, v.v, type, 1));
+	return true;
 }
 
 static int
@@ -128,76 +336,55 @@ ldestory_tracks(lua_State *L){
 	return 0;
 }
 
+// three passes: update the ratios, sample all the tracks in one batch, write the changed values back to scene
 static int lsample(lua_State *L){
 	auto w = getworld(L);
 
 	const float delta = (float)luaL_checknumber(L, 2);
 
 	//int gids[] = {gid};ecs::group_enable<component::motion_sampler_tag>(w->ecs, gids);
-	
+
+	g_jobs.clear();
 	for (auto& e : ecs::select<component::motion_sampler_tag, component::motion_sampler, component::scene>(w->ecs)) {
 		auto &ms = e.get<component::motion_sampler>();
 		auto mt = (struct motion_tracks*)ms.motion_tracks;
 		if (nullptr == mt)
 			continue;
 
-        bool needupdate = true;
-        if (ms.duration >= 0){
-            needupdate = ms.current <= ms.duration && (!ms.stop);
-            if (needupdate){
-                ms.current = ms.current + (ms.is_tick ? 1.f : delta);
-                ms.ratio = tween(std::min(1.f, ms.current / ms.duration), (tween_type)ms.tween_in, (tween_type)ms.tween_out);
+		bool needupdate = true;
+		if (ms.duration >= 0){
+			needupdate = ms.current <= ms.duration && (!ms.stop);
+			if (needupdate){
+				ms.current = ms.current + (ms.is_tick ? 1.f : delta);
+				ms.ratio = tween(std::min(1.f, ms.current / ms.duration), (tween_type)ms.tween_in, (tween_type)ms.tween_out);
 			}
 		}
+		g_jobs.push_back(motion_job{mt, ms.ratio, needupdate});
+	}
 
-        if (needupdate){
-			auto &scene = e.get<component::scene>();
-
-			auto M = w->math3d->M;
-
-			if (mt->s.get()){
-				ozz::animation::Float3TrackSamplingJob job;
-				ozz::math::Float3 s;
-				job.track = mt->s.get();
-				job.result = &s;
-				job.ratio = ms.ratio;
-				if (!job.Run()){
-					luaL_error(L, "Sampling scale failed");
-				}
-
-				math_unmark(M, scene.s);
-				scene.s = math_mark(M, math_import(M, &s.x, MATH_TYPE_VEC4, 1));
-			}
-
-			if (mt->r.get()){
-				ozz::animation::QuaternionTrackSamplingJob job;
-				ozz::math::Quaternion r;
-				job.track = mt->r.get();
-				job.result = &r;
-				job.ratio = ms.ratio;
-				if (!job.Run()){
-					luaL_error(L, "Sampling rotation failed");
-				}
-
-				math_unmark(M, scene.r);
-				scene.r = math_mark(M, math_import(M, &r.x, MATH_TYPE_QUAT, 1));
-			}
+	sample_jobs(g_jobs.data(), (uint32_t)g_jobs.size());
 
-			if (mt->t.get()){
-				ozz::animation::Float3TrackSamplingJob job;
-				ozz::math::Float3 t;
-				job.track = mt->t.get();
-				job.result = &t;
-				job.ratio = ms.ratio;
-				if (!job.Run()){
-					luaL_error(L, "Sampling translation failed");
-				}
+	// same entities in the same order as the first pass
+	auto M = w->math3d->M;
+	size_t idx = 0;
+	for (auto& e : ecs::select<component::motion_sampler_tag, component::motion_sampler, component::scene>(w->ecs)) {
+		if (nullptr == e.get<component::motion_sampler>().motion_tracks)
+			continue;
+		assert(idx < g_jobs.size());
+		const motion_job &j = g_jobs[idx++];
+		if (!j.update)
+			continue;
 
-				math_unmark(M, scene.t);
-				scene.t = math_mark(M, math_import(M, &t.x, MATH_TYPE_VEC4, 1));
-			}
-            e.enable_tag<component::scene_needchange>();
-		}
+		auto &scene = e.get<component::scene>();
+		bool changed = false;
+		if (j.mt->s.count)
+			changed |= write_value(M, scene.s, j.s, MATH_TYPE_VEC4);
+		if (j.mt->r.count)
+			changed |= write_value(M, scene.r, j.r, MATH_TYPE_QUAT);
+		if (j.mt->t.count)
+			changed |= write_value(M, scene.t, j.t, MATH_TYPE_VEC4);
+		if (changed)
+			e.enable_tag<component::scene_needchange>();
 	}
 	return 0;
 }
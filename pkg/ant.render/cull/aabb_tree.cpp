@@ -0,0 +1,254 @@
+#include "aabb_tree.h"
+
+#include <algorithm>
+#include <cassert>
+
+tree_aabb
+tree_aabb::merge(const tree_aabb &a, const tree_aabb &b){
+	tree_aabb r;
+	for (int ii=0; ii<3; ++ii){
+		r.minv[ii] = std::min(a.minv[ii], b.minv[ii]);
+		r.maxv[ii] = std::max(a.maxv[ii], b.maxv[ii]);
+	}
+	return r;
+}
+
+static inline tree_aabb
+fatten(const tree_aabb &box, float margin){
+	tree_aabb r;
+	for (int ii=0; ii<3; ++ii){
+		r.minv[ii] = box.minv[ii] - margin;
+		r.maxv[ii] = box.maxv[ii] + margin;
+	}
+	return r;
+}
+
+int
+aabb_tree::alloc_node(){
+	if (freelist == NULL_NODE){
+		nodes.emplace_back();
+		freelist = (int)nodes.size() - 1;
+		nodes[freelist].parent = NULL_NODE;
+	}
+	const int idx = freelist;
+	node &n = nodes[idx];
+	freelist = n.parent;
+	n.parent = n.child1 = n.child2 = NULL_NODE;
+	n.height = 0;
+	n.data = 0;
+	return idx;
+}
+
+void
+aabb_tree::free_node(int idx){
+	node &n = nodes[idx];
+	n.parent = freelist;
+	n.height = -1;
+	freelist = idx;
+}
+
+int
+aabb_tree::insert(const tree_aabb &box, uint32_t data){
+	const int leaf = alloc_node();
+	node &n = nodes[leaf];
+	n.box = box;
+	n.fat = fatten(box, margin);
+	n.data = data;
+	insert_leaf(leaf);
+	++leaf_count;
+	return leaf;
+}
+
+void
+aabb_tree::remove(int proxy){
+	assert(0 <= proxy && proxy < (int)nodes.size() && nodes[proxy].isleaf());
+	remove_leaf(proxy);
+	free_node(proxy);
+	--leaf_count;
+}
+
+bool
+aabb_tree::move(int proxy, const tree_aabb &box){
+	assert(0 <= proxy && proxy < (int)nodes.size() && nodes[proxy].isleaf());
+	node &n = nodes[proxy];
+	n.box = box;
+	if (n.fat.contains(box))
+		return false;
+
+	remove_leaf(proxy);
+	nodes[proxy].fat = fatten(box, margin);
+	insert_leaf(proxy);
+	return true;
+}
+
+void
+aabb_tree::clear(){
+	nodes.clear();
+	root_node = freelist = NULL_NODE;
+	leaf_count = 0;
+}
+
+// pick the sibling by surface area heuristic, same as box2d
+void
+aabb_tree::insert_leaf(int leaf){
+	if (root_node == NULL_NODE){
+		root_node = leaf;
+		nodes[leaf].parent = NULL_NODE;
+		return;
+	}
+
+	const tree_aabb leafbox = nodes[leaf].fat;
+	int idx = root_node;
+	while (!nodes[idx].isleaf()){
+		const node &n = nodes[idx];
+		const float area = n.fat.area();
+		const float combined = tree_aabb::merge(n.fat, leafbox).area();
+
+		// cost of creating a new parent for this node and the new leaf
+		const float cost = 2.f * combined;
+		// minimum cost of pushing the leaf further down the tree
+		const float inheritance = 2.f * (combined - area);
+
+		auto descend_cost = [&](int child){
+			const node &c = nodes[child];
+			const float a = tree_aabb::merge(leafbox, c.fat).area();
+			return c.isleaf() ? a + inheritance : (a - c.fat.area()) + inheritance;
+		};
+		const float cost1 = descend_cost(n.child1);
+		const float cost2 = descend_cost(n.child2);
+
+		if (cost < cost1 && cost < cost2)
+			break;
+		idx = cost1 < cost2 ? n.child1 : n.child2;
+	}
+
+	const int sibling = idx;
+	const int oldparent = nodes[sibling].parent;
+	const int newparent = alloc_node();
+	{
+		node &p = nodes[newparent];
+		p.parent = oldparent;
+		p.fat = tree_aabb::merge(leafbox, nodes[sibling].fat);
+		p.height = nodes[sibling].height + 1;
+		p.child1 = sibling;
+		p.child2 = leaf;
+	}
+	nodes[sibling].parent = newparent;
+	nodes[leaf].parent = newparent;
+
+	if (oldparent == NULL_NODE){
+		root_node = newparent;
+	} else {
+		node &op = nodes[oldparent];
+		if (op.child1 == sibling){
+			op.child1 = newparent;
+		} else {
+			op.child2 = newparent;
+		}
+	}
+
+	refit(newparent);
+}
+
+void
+aabb_tree::remove_leaf(int leaf){
+	if (leaf == root_node){
+		root_node = NULL_NODE;
+		return;
+	}
+
+	const int parent = nodes[leaf].parent;
+	const int grandparent = nodes[parent].parent;
+	const int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+	if (grandparent == NULL_NODE){
+		root_node = sibling;
+		nodes[sibling].parent = NULL_NODE;
+		free_node(parent);
+		return;
+	}
+
+	node &gp = nodes[grandparent];
+	if (gp.child1 == parent){
+		gp.child1 = sibling;
+	} else {
+		gp.child2 = sibling;
+	}
+	nodes[sibling].parent = grandparent;
+	free_node(parent);
+
+	refit(grandparent);
+}
+
+// walk to the root, rebalance and recompute boxes/heights
+void
+aabb_tree::refit(int idx){
+	while (idx != NULL_NODE){
+		idx = balance(idx);
+
+		node &n = nodes[idx];
+		const node &c1 = nodes[n.child1];
+		const node &c2 = nodes[n.child2];
+		n.height = 1 + std::max(c1.height, c2.height);
+		n.fat = tree_aabb::merge(c1.fat, c2.fat);
+
+		idx = n.parent;
+	}
+}
+
+// rotate A's higher child up if the tree is unbalanced, return the index of the new subtree root
+int
+aabb_tree::balance(int ia){
+	node *A = &nodes[ia];
+	if (A->isleaf() || A->height < 2)
+		return ia;
+
+	const int ib = A->child1, ic = A->child2;
+	const int diff = nodes[ic].height - nodes[ib].height;
+	if (diff >= -1 && diff <= 1)
+		return ia;
+
+	// promote the higher child F(B or C) over A
+	const int ihigh = diff > 1 ? ic : ib;
+	const int ilow  = diff > 1 ? ib : ic;
+	node *H = &nodes[ihigh];
+	const int i1 = H->child1, i2 = H->child2;
+
+	H->child1 = ia;
+	H->parent = A->parent;
+	A->parent = ihigh;
+
+	if (H->parent == NULL_NODE){
+		root_node = ihigh;
+	} else {
+		node &p = nodes[H->parent];
+		if (p.child1 == ia){
+			p.child1 = ihigh;
+		} else {
+			assert(p.child2 == ia);
+			p.child2 = ihigh;
+		}
+	}
+
+	// keep the higher grandchild under H, the other one goes to A
+	const int ikeep = nodes[i1].height > nodes[i2].height ? i1 : i2;
+	const int imove = ikeep == i1 ? i2 : i1;
+	H->child2 = ikeep;
+	if (diff > 1){
+		A->child2 = imove;
+	} else {
+		A->child1 = imove;
+	}
+	nodes[imove].parent = ia;
+
+	const node &low = nodes[ilow];
+	const node &mv = nodes[imove];
+	A->fat = tree_aabb::merge(low.fat, mv.fat);
+	A->height = 1 + std::max(low.height, mv.height);
+
+	const node &keep = nodes[ikeep];
+	H->fat = tree_aabb::merge(A->fat, keep.fat);
+	H->height = 1 + std::max(A->height, keep.height);
+
+	return ihigh;
+}
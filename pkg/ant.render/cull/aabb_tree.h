@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct tree_aabb {
+	float minv[3];
+	float maxv[3];
+
+	bool contains(const tree_aabb &o) const {
+		return	minv[0] <= o.minv[0] && minv[1] <= o.minv[1] && minv[2] <= o.minv[2] &&
+				o.maxv[0] <= maxv[0] && o.maxv[1] <= maxv[1] && o.maxv[2] <= maxv[2];
+	}
+
+	bool overlap(const tree_aabb &o) const {
+		return	minv[0] <= o.maxv[0] && o.minv[0] <= maxv[0] &&
+				minv[1] <= o.maxv[1] && o.minv[1] <= maxv[1] &&
+				minv[2] <= o.maxv[2] && o.minv[2] <= maxv[2];
+	}
+
+	float area() const {
+		const float dx = maxv[0] - minv[0], dy = maxv[1] - minv[1], dz = maxv[2] - minv[2];
+		return 2.f * (dx * dy + dy * dz + dz * dx);
+	}
+
+	static tree_aabb merge(const tree_aabb &a, const tree_aabb &b);
+};
+
+// Dynamic bounding volume tree, leaves keep a fattened box so small movements don't touch the tree.
+// Proxy id is the leaf node index, it's stable until remove().
+struct aabb_tree {
+	static constexpr int NULL_NODE = -1;
+
+	struct node {
+		tree_aabb	fat;
+		tree_aabb	box;		// tight box, only valid for leaf
+		int			parent;		// next free node when it's in free list
+		int			child1;
+		int			child2;
+		int			height;		// leaf = 0, free = -1
+		uint32_t	data;
+
+		bool isleaf() const { return child1 == NULL_NODE; }
+	};
+
+	explicit aabb_tree(float margin = 0.1f) : margin(margin) {}
+
+	int insert(const tree_aabb &box, uint32_t data);
+	void remove(int proxy);
+	// return true if the leaf is reinserted
+	bool move(int proxy, const tree_aabb &box);
+	void clear();
+
+	const node& get(int proxy) const { return nodes[proxy]; }
+	int root() const { return root_node; }
+	uint32_t size() const { return leaf_count; }
+	uint32_t capacity() const { return (uint32_t)nodes.size(); }
+	int height() const { return root_node == NULL_NODE ? 0 : nodes[root_node].height; }
+
+	// test(const tree_aabb &) returns <0 outside, 0 intersect, >0 totally inside
+	// visit(int proxy, bool inside) is called for every leaf which is not outside,
+	// inside is true when its ancestor is totally inside, then the leaf box is not tested
+	template<typename Test, typename Visit>
+	void query(Test &&test, Visit &&visit) const {
+		if (root_node == NULL_NODE)
+			return;
+		stack.clear();
+		stack.push_back({root_node, false});
+		while (!stack.empty()){
+			const auto [idx, inside] = stack.back();
+			stack.pop_back();
+			const node &n = nodes[idx];
+			bool in = inside;
+			if (!in){
+				const int r = test(n.isleaf() ? n.box : n.fat);
+				if (r < 0)
+					continue;
+				in = r > 0;
+			}
+			if (n.isleaf()){
+				visit(idx, in);
+			} else {
+				stack.push_back({n.child1, in});
+				stack.push_back({n.child2, in});
+			}
+		}
+	}
+
+private:
+	struct stack_item {
+		int		idx;
+		bool	inside;
+	};
+
+	int alloc_node();
+	void free_node(int idx);
+	void insert_leaf(int leaf);
+	void remove_leaf(int leaf);
+	int balance(int idx);
+	void refit(int idx);
+
+	std::vector<node>	nodes;
+	int					root_node = NULL_NODE;
+	int					freelist = NULL_NODE;
+	uint32_t			leaf_count = 0;
+	float				margin;
+	mutable std::vector<stack_item> stack;
+};
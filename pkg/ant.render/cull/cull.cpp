@@ -8,6 +8,8 @@ extern "C"{
 }
 
 #include "../render/queue.h"
+#include "jobpool.h"
+#include "aabb_tree.h"
 
 #include <cassert>
 #include <cstring>
@@ -15,7 +17,17 @@ extern "C"{
 #include <unordered_map>
 #include <vector>
 #include <algorithm>
+#include <bit>
+#include <cmath>
+#include <atomic>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define CULL_SIMD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define CULL_SIMD_NEON
+#endif
 
 using tags = std::vector<int>;
 using cull_infos = std::unordered_map<uint64_t, tags>;
@@ -64,33 +76,417 @@ struct cullqueue_cache {
 	}
 };
 
-struct cull_cached {
-	cull_cached(struct ecs_context* ctx) : render_obj(ctx), hitch_obj(ctx){}
-	ecs::cached_context<component::render_object_visible, component::render_object, component::bounding> render_obj;
-	ecs::cached_context<component::hitch_visible, component::hitch, component::bounding> hitch_obj;
-}; 
-
-template<typename ObjType>
-struct cull_operation{
-	template<typename EntityType>
-	static void cull(struct ecs_world*w, EntityType &e, struct cullqueue_cache *cc){
-		const auto &b = e.template get<component::bounding>();
-
-		if (!math_isnull(b.scene_aabb)){
-			auto &o = e.template get<ObjType>();
-			for (uint8_t ii=0; ii<cc->count; ++ii){
-				struct cullqueue_info& q = cc->cq[ii];
-				const bool isculled = math3d_frustum_intersect_aabb(w->math3d->M, q.mid, b.scene_aabb) < 0;
-				queue_set_by_index(w->Q, o.cull_idx, q.Qidx, isculled);
+static constexpr uint8_t NUM_QUEUE_MASK = MAX_VISIBLE_QUEUE / 64;
+static constexpr uint8_t NUM_FRUSTUM_PLANE = 6;
+
+// planes in SoA, |normal| is for the extents of aabb
+struct cull_frustum {
+	float nx[NUM_FRUSTUM_PLANE], ny[NUM_FRUSTUM_PLANE], nz[NUM_FRUSTUM_PLANE], d[NUM_FRUSTUM_PLANE];
+	float ax[NUM_FRUSTUM_PLANE], ay[NUM_FRUSTUM_PLANE], az[NUM_FRUSTUM_PLANE];
+	uint64_t queuemasks[NUM_QUEUE_MASK];
+
+	void init(const float *planes){
+		for (uint8_t ii=0; ii<NUM_FRUSTUM_PLANE; ++ii){
+			const float *p = planes + ii * 4;
+			nx[ii] = p[0]; ny[ii] = p[1]; nz[ii] = p[2]; d[ii] = p[3];
+			ax[ii] = std::abs(p[0]); ay[ii] = std::abs(p[1]); az[ii] = std::abs(p[2]);
+		}
+	}
+
+	// <0 outside, 0 intersect, >0 inside
+	int test(const tree_aabb &b) const {
+		const float cx = (b.maxv[0] + b.minv[0]) * 0.5f, ex = (b.maxv[0] - b.minv[0]) * 0.5f;
+		const float cy = (b.maxv[1] + b.minv[1]) * 0.5f, ey = (b.maxv[1] - b.minv[1]) * 0.5f;
+		const float cz = (b.maxv[2] + b.minv[2]) * 0.5f, ez = (b.maxv[2] - b.minv[2]) * 0.5f;
+		int r = 1;
+		for (uint8_t ii=0; ii<NUM_FRUSTUM_PLANE; ++ii){
+			const float dist = nx[ii] * cx + ny[ii] * cy + nz[ii] * cz + d[ii];
+			const float radius = ax[ii] * ex + ay[ii] * ey + az[ii] * ez;
+			if (dist + radius < 0.f)
+				return -1;
+			if (dist - radius < 0.f)
+				r = 0;
+		}
+		return r;
+	}
+};
+
+// scene_aabb of all cullable objects as center/extent SoA, padded to SIMD width
+struct cull_batch {
+	static constexpr uint32_t WIDTH = 4;
+
+	std::vector<float> cx, cy, cz, ex, ey, ez;
+	std::vector<int> cull_idx;
+	// bit N is set when the object is culled by frustum N
+	std::vector<uint64_t> culled;
+	uint32_t num = 0;
+
+	void clear(){
+		cx.clear(); cy.clear(); cz.clear();
+		ex.clear(); ey.clear(); ez.clear();
+		cull_idx.clear();
+		num = 0;
+	}
+
+	void add(const tree_aabb &b, int idx){
+		const float *minv = b.minv, *maxv = b.maxv;
+		cx.push_back((maxv[0] + minv[0]) * 0.5f); ex.push_back((maxv[0] - minv[0]) * 0.5f);
+		cy.push_back((maxv[1] + minv[1]) * 0.5f); ey.push_back((maxv[1] - minv[1]) * 0.5f);
+		cz.push_back((maxv[2] + minv[2]) * 0.5f); ez.push_back((maxv[2] - minv[2]) * 0.5f);
+		cull_idx.push_back(idx);
+		++num;
+	}
+
+	void pad(){
+		while (cx.size() % WIDTH){
+			cx.push_back(0.f); cy.push_back(0.f); cz.push_back(0.f);
+			ex.push_back(0.f); ey.push_back(0.f); ez.push_back(0.f);
+		}
+		culled.assign(cx.size(), 0);
+	}
+};
+
+// return bit mask of the 4 boxes from idx, which are totally outside of the frustum
+static inline uint32_t
+frustum_cull4(const cull_frustum &f, const cull_batch &b, uint32_t idx){
+#if defined(CULL_SIMD_SSE)
+	const __m128 cx = _mm_loadu_ps(&b.cx[idx]), cy = _mm_loadu_ps(&b.cy[idx]), cz = _mm_loadu_ps(&b.cz[idx]);
+	const __m128 ex = _mm_loadu_ps(&b.ex[idx]), ey = _mm_loadu_ps(&b.ey[idx]), ez = _mm_loadu_ps(&b.ez[idx]);
+	__m128 outside = _mm_setzero_ps();
+	for (uint8_t ii=0; ii<NUM_FRUSTUM_PLANE; ++ii){
+		__m128 dist = _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(f.nx[ii])), _mm_set1_ps(f.d[ii]));
+		dist = _mm_add_ps(dist, _mm_mul_ps(cy, _mm_set1_ps(f.ny[ii])));
+		dist = _mm_add_ps(dist, _mm_mul_ps(cz, _mm_set1_ps(f.nz[ii])));
+		__m128 radius = _mm_mul_ps(ex, _mm_set1_ps(f.ax[ii]));
+		radius = _mm_add_ps(radius, _mm_mul_ps(ey, _mm_set1_ps(f.ay[ii])));
+		radius = _mm_add_ps(radius, _mm_mul_ps(ez, _mm_set1_ps(f.az[ii])));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()));
+	}
+	return (uint32_t)_mm_movemask_ps(outside);
+#elif defined(CULL_SIMD_NEON)
+	const float32x4_t cx = vld1q_f32(&b.cx[idx]), cy = vld1q_f32(&b.cy[idx]), cz = vld1q_f32(&b.cz[idx]);
+	const float32x4_t ex = vld1q_f32(&b.ex[idx]), ey = vld1q_f32(&b.ey[idx]), ez = vld1q_f32(&b.ez[idx]);
+	uint32x4_t outside = vdupq_n_u32(0);
+	for (uint8_t ii=0; ii<NUM_FRUSTUM_PLANE; ++ii){
+		float32x4_t dist = vmlaq_n_f32(vdupq_n_f32(f.d[ii]), cx, f.nx[ii]);
+		dist = vmlaq_n_f32(dist, cy, f.ny[ii]);
+		dist = vmlaq_n_f32(dist, cz, f.nz[ii]);
+		float32x4_t radius = vmulq_n_f32(ex, f.ax[ii]);
+		radius = vmlaq_n_f32(radius, ey, f.ay[ii]);
+		radius = vmlaq_n_f32(radius, ez, f.az[ii]);
+		outside = vorrq_u32(outside, vcltq_f32(vaddq_f32(dist, radius), vdupq_n_f32(0.f)));
+	}
+	static const uint32_t bits[4] = {1, 2, 4, 8};
+	const uint32x4_t m = vandq_u32(outside, vld1q_u32(bits));
+	const uint32x2_t s = vadd_u32(vget_low_u32(m), vget_high_u32(m));
+	return vget_lane_u32(vpadd_u32(s, s), 0);
+#else
+	uint32_t outside = 0;
+	for (uint32_t jj=0; jj<cull_batch::WIDTH; ++jj){
+		const uint32_t i = idx + jj;
+		for (uint8_t ii=0; ii<NUM_FRUSTUM_PLANE; ++ii){
+			const float dist = f.nx[ii] * b.cx[i] + f.ny[ii] * b.cy[i] + f.nz[ii] * b.cz[i] + f.d[ii];
+			const float radius = f.ax[ii] * b.ex[i] + f.ay[ii] * b.ey[i] + f.az[ii] * b.ez[i];
+			if (dist + radius < 0.f){
+				outside |= 1u << jj;
+				break;
+			}
+		}
+	}
+	return outside;
+#endif
+}
+
+static constexpr uint8_t MAX_CULL_WORKER = 8;
+// objects per job chunk, must be multiple of cull_batch::WIDTH
+static constexpr uint32_t CULL_CHUNK_SIZE = 2048;
+
+static inline tree_aabb
+to_tree_aabb(struct ecs_world *w, math_t aabb){
+	// aabb: min(vec4), max(vec4)
+	const float *v = math_value(w->math3d->M, aabb);
+	return tree_aabb{{v[0], v[1], v[2]}, {v[4], v[5], v[6]}};
+}
+
+// every render_object/hitch with scene_aabb has a proxy in the tree, it's updated by 'bounding_changed' and 'REMOVED'
+struct cull_tree {
+	struct object {
+		int			cull_idx = -1;		// -1 means the node is not a live proxy
+		uint64_t	eid = 0;
+		uint64_t	inside = 0;			// frustums(bit N is frustum N) which can see the object in the last cull
+		uint64_t	current = 0;		// same as inside, valid in current cull when mark == frame
+		uint32_t	mark = 0;
+		bool		dirty = false;		// cull mask never written
+		uint32_t	live_pos = 0;
+	};
+
+	aabb_tree			tree;
+	std::vector<object>	objects;		// indexed by proxy
+	std::vector<int>	proxy_of;		// indexed by cull_idx
+	std::vector<int>	live;			// all the proxies
+	std::vector<int>	changed;		// moved or inserted since last cull
+	std::vector<int>	visible;		// proxies with inside != 0
+	std::vector<int>	candidates;
+	uint32_t			frame = 0;
+
+	// frustum layout of the last cull, different layout means all the masks should be rewritten
+	uint16_t			last_count = 0;
+	uint64_t			last_queuemasks[MAX_VISIBLE_QUEUE][NUM_QUEUE_MASK];
+	bool				full = true;
+
+	int find(int cull_idx) const {
+		return (cull_idx >= 0 && cull_idx < (int)proxy_of.size()) ? proxy_of[cull_idx] : aabb_tree::NULL_NODE;
+	}
+
+	void update(int cull_idx, uint64_t eid, const tree_aabb *box){
+		if (cull_idx < 0)
+			return;
+		int proxy = find(cull_idx);
+		if (box == nullptr){
+			if (proxy != aabb_tree::NULL_NODE){
+				remove(cull_idx);
+			}
+			return;
+		}
+		if (proxy == aabb_tree::NULL_NODE){
+			proxy = tree.insert(*box, (uint32_t)cull_idx);
+			if (proxy >= (int)objects.size()){
+				objects.resize(tree.capacity());
+			}
+			if (cull_idx >= (int)proxy_of.size()){
+				proxy_of.resize(cull_idx + 1, aabb_tree::NULL_NODE);
+			}
+			proxy_of[cull_idx] = proxy;
+
+			object &o = objects[proxy];
+			o = object{};
+			o.cull_idx = cull_idx;
+			o.dirty = true;
+			o.live_pos = (uint32_t)live.size();
+			live.push_back(proxy);
+		} else {
+			tree.move(proxy, *box);
+		}
+		objects[proxy].eid = eid;
+		changed.push_back(proxy);
+	}
+
+	void remove(int cull_idx){
+		const int proxy = find(cull_idx);
+		if (proxy == aabb_tree::NULL_NODE)
+			return;
+		tree.remove(proxy);
+		proxy_of[cull_idx] = aabb_tree::NULL_NODE;
+
+		object &o = objects[proxy];
+		const int last = live.back();
+		live[o.live_pos] = last;
+		objects[last].live_pos = o.live_pos;
+		live.pop_back();
+		o.cull_idx = -1;
+	}
+
+	void check_layout(const cull_frustum *frustums, uint16_t count){
+		bool same = count == last_count;
+		for (uint16_t fi=0; fi<count && same; ++fi){
+			same = memcmp(last_queuemasks[fi], frustums[fi].queuemasks, sizeof(last_queuemasks[fi])) == 0;
+		}
+		if (!same){
+			full = true;
+			last_count = count;
+			for (uint16_t fi=0; fi<count; ++fi){
+				memcpy(last_queuemasks[fi], frustums[fi].queuemasks, sizeof(last_queuemasks[fi]));
 			}
 		}
 	}
 };
 
+struct cull_cached {
+	cull_batch batch;
+	cull_frustum frustums[MAX_VISIBLE_QUEUE];
+	std::unique_ptr<job_pool> pool;
+	cull_tree objs;
+
+	void set_workers(int n){
+		n = std::clamp(n, 1, (int)MAX_CULL_WORKER);
+		pool.reset(n > 1 ? new job_pool(n) : nullptr);
+	}
+
+	int workers() const {
+		return pool ? pool->size() : 1;
+	}
+};
+
+
+// test objects in [from, to), from must be aligned to cull_batch::WIDTH
+static void
+cull_batch_test(const cull_frustum *frustums, uint16_t count, cull_batch &batch, uint32_t from, uint32_t to){
+	for (uint16_t fi=0; fi<count; ++fi){
+		const cull_frustum &f = frustums[fi];
+		const uint64_t bit = 1ull << fi;
+		for (uint32_t ii=from; ii<to; ii += cull_batch::WIDTH){
+			uint32_t outside = frustum_cull4(f, batch, ii);
+			while (outside){
+				const uint32_t jj = (uint32_t)std::countr_zero(outside);
+				batch.culled[ii+jj] |= bit;
+				outside &= outside - 1;
+			}
+		}
+	}
+}
+
+// every object is tested by all the cull queues, so rewrite all their bits in one go
+// objects own different queue nodes, so chunks can be applied in parallel
+static inline void
+cull_write(struct ecs_world *w, const cull_frustum *frustums, const uint64_t *selmasks, int cull_idx, uint64_t culled){
+	uint64_t values[NUM_QUEUE_MASK] = {0};
+	for (uint64_t c = culled; c; c &= c - 1){
+		const cull_frustum &f = frustums[std::countr_zero(c)];
+		for (uint8_t mi=0; mi<NUM_QUEUE_MASK; ++mi){
+			values[mi] |= f.queuemasks[mi];
+		}
+	}
+	queue_update(w->Q, cull_idx, selmasks, values);
+}
+
+static inline void
+cull_selmasks(const cull_frustum *frustums, uint16_t count, uint64_t *selmasks){
+	for (uint8_t mi=0; mi<NUM_QUEUE_MASK; ++mi){
+		selmasks[mi] = 0;
+	}
+	for (uint16_t fi=0; fi<count; ++fi){
+		for (uint8_t mi=0; mi<NUM_QUEUE_MASK; ++mi){
+			selmasks[mi] |= frustums[fi].queuemasks[mi];
+		}
+	}
+}
+
+static void
+cull_batch_apply(struct ecs_world *w, const cull_frustum *frustums, uint16_t count, const cull_batch &batch, uint32_t from, uint32_t to){
+	uint64_t selmasks[NUM_QUEUE_MASK];
+	cull_selmasks(frustums, count, selmasks);
+	// most objects are culled by nothing, clear their bits in bulk
+	int inside[64];
+	uint32_t ninside = 0;
+	for (uint32_t ii=from; ii<to; ++ii){
+		if (batch.culled[ii]){
+			cull_write(w, frustums, selmasks, batch.cull_idx[ii], batch.culled[ii]);
+			continue;
+		}
+		inside[ninside++] = batch.cull_idx[ii];
+		if (ninside == 64){
+			queue_andnot(w->Q, inside, ninside, selmasks);
+			ninside = 0;
+		}
+	}
+	queue_andnot(w->Q, inside, ninside, selmasks);
+}
+
+static void
+cull_batch_run(struct ecs_world *w, struct cull_cached *cc, uint16_t count){
+	cull_batch &batch = cc->batch;
+	if (!cc->pool || batch.num <= CULL_CHUNK_SIZE){
+		cull_batch_test(cc->frustums, count, batch, 0, batch.num);
+		cull_batch_apply(w, cc->frustums, count, batch, 0, batch.num);
+		return;
+	}
+
+	std::atomic<uint32_t> next{0};
+	cc->pool->run([&](int){
+		for (uint32_t from = next.fetch_add(CULL_CHUNK_SIZE); from < batch.num; from = next.fetch_add(CULL_CHUNK_SIZE)){
+			const uint32_t to = std::min(from + CULL_CHUNK_SIZE, batch.num);
+			cull_batch_test(cc->frustums, count, batch, from, to);
+			cull_batch_apply(w, cc->frustums, count, batch, from, to);
+		}
+	});
+}
+
+static inline uint64_t
+frustum_bits(uint16_t count){
+	return count >= 64 ? ~0ull : ((1ull << count) - 1);
+}
+
+// brute force: test every proxy with simd batch
+static void
+cull_full(struct ecs_world *w, struct cull_cached *cc, uint16_t count){
+	auto &objs = cc->objs;
+	auto &batch = cc->batch;
+	batch.clear();
+	for (int proxy : objs.live){
+		batch.add(objs.tree.get(proxy).box, objs.objects[proxy].cull_idx);
+	}
+	batch.pad();
+	cull_batch_run(w, cc, count);
+
+	const uint64_t all = frustum_bits(count);
+	objs.visible.clear();
+	for (uint32_t ii=0; ii<batch.num; ++ii){
+		auto &o = objs.objects[objs.live[ii]];
+		o.inside = all & ~batch.culled[ii];
+		o.dirty = false;
+		if (o.inside){
+			objs.visible.push_back(objs.live[ii]);
+		}
+	}
+	objs.changed.clear();
+	objs.full = false;
+}
+
+// walk the tree for every frustum, only the objects which are visible now or in the last cull, or changed, are rewritten
+static void
+cull_incremental(struct ecs_world *w, struct cull_cached *cc, uint16_t count){
+	auto &objs = cc->objs;
+	const uint32_t frame = ++objs.frame;
+	objs.candidates.clear();
+	auto touch = [&](int proxy) -> cull_tree::object& {
+		auto &o = objs.objects[proxy];
+		if (o.mark != frame){
+			o.mark = frame;
+			o.current = 0;
+			objs.candidates.push_back(proxy);
+		}
+		return o;
+	};
+
+	for (uint16_t fi=0; fi<count; ++fi){
+		const cull_frustum &f = cc->frustums[fi];
+		const uint64_t bit = 1ull << fi;
+		objs.tree.query(
+			[&f](const tree_aabb &b){ return f.test(b); },
+			[&](int proxy, bool){ touch(proxy).current |= bit; });
+	}
+	for (int proxy : objs.visible){
+		if (objs.objects[proxy].cull_idx >= 0)
+			touch(proxy);
+	}
+	for (int proxy : objs.changed){
+		if (objs.objects[proxy].cull_idx >= 0)
+			touch(proxy);
+	}
+	objs.changed.clear();
+
+	uint64_t selmasks[NUM_QUEUE_MASK];
+	cull_selmasks(cc->frustums, count, selmasks);
+	const uint64_t all = frustum_bits(count);
+	objs.visible.clear();
+	for (int proxy : objs.candidates){
+		auto &o = objs.objects[proxy];
+		const uint64_t inside = o.current;
+		if (o.dirty || inside != o.inside){
+			cull_write(w, cc->frustums, selmasks, o.cull_idx, all & ~inside);
+			o.inside = inside;
+			o.dirty = false;
+		}
+		if (inside){
+			objs.visible.push_back(proxy);
+		}
+	}
+}
+
 static int
 linit(lua_State *L) {
 	auto w = getworld(L);
-	w->cull_cached = new struct cull_cached(w->ecs);
+	w->cull_cached = new struct cull_cached;
 	return 0;
 }
 
@@ -101,6 +497,14 @@ lexit(lua_State *L) {
 	return 0;
 }
 
+static int
+lworkers(lua_State *L) {
+	auto w = getworld(L);
+	w->cull_cached->set_workers((int)luaL_checkinteger(L, 1));
+	lua_pushinteger(L, w->cull_cached->workers());
+	return 1;
+}
+
 static int
 lcull(lua_State *L) {
 	auto w = getworld(L);
@@ -112,17 +516,173 @@ lcull(lua_State *L) {
 	}
 
 	if (!cqc.empty()){
-		for (auto e : ecs::cached_select(w->cull_cached->render_obj)) {
-			cull_operation<component::render_object>::cull(w, e, &cqc);
+		auto cc = w->cull_cached;
+		for (uint16_t ii=0; ii<cqc.count; ++ii){
+			cull_frustum &f = cc->frustums[ii];
+			f.init(math_value(w->math3d->M, cqc.cq[ii].mid));
+			queue_fetch(w->Q, cqc.cq[ii].Qidx, f.queuemasks);
 		}
 
-		for (auto& e : ecs::cached_select(w->cull_cached->hitch_obj)) {
-			cull_operation<component::hitch>::cull(w, e, &cqc);
+		cc->objs.check_layout(cc->frustums, cqc.count);
+		if (cc->objs.full){
+			cull_full(w, cc, cqc.count);
+		} else {
+			cull_incremental(w, cc, cqc.count);
 		}
 	}
 	return 0;
 }
 
+// bounding_update publishes its boxes in entity order, so it's walked along with the 'bounding_changed' selection
+struct scene_aabb_cursor {
+	const scene_aabb_buffer *buffer;
+	uint32_t pos = 0;
+
+	const float* find(uint64_t eid, math_t id){
+		if (buffer == nullptr)
+			return nullptr;
+		while (pos < buffer->n && buffer->eids[pos] < eid)
+			++pos;
+		if (pos < buffer->n && buffer->eids[pos] == eid && buffer->ids[pos] == id.idx)
+			return buffer->aabbs + pos * 8;
+		return nullptr;
+	}
+};
+
+template<typename ObjType, typename EntityType>
+static inline bool
+sync_proxy(struct ecs_world *w, EntityType &e, const component::bounding &b, scene_aabb_cursor &cursor){
+	const auto o = e.template component<ObjType>();
+	if (!o)
+		return false;
+	const uint64_t eid = (uint64_t)e.template get<component::eid>();
+	if (math_isnull(b.scene_aabb)){
+		w->cull_cached->objs.update(o->cull_idx, eid, nullptr);
+	} else {
+		const float *v = cursor.find(eid, b.scene_aabb);
+		const tree_aabb box = v ? tree_aabb{{v[0], v[1], v[2]}, {v[4], v[5], v[6]}} : to_tree_aabb(w, b.scene_aabb);
+		w->cull_cached->objs.update(o->cull_idx, eid, &box);
+	}
+	return true;
+}
+
+// sync the proxies of 'bounding_changed' entities, return true if any proxy is changed
+static int
+lupdate(lua_State *L) {
+	auto w = getworld(L);
+	auto &objs = w->cull_cached->objs;
+	scene_aabb_cursor cursor{w->scene_aabbs};
+	for (auto& e : ecs::select<component::bounding_changed, component::bounding, component::eid>(w->ecs)) {
+		const auto &b = e.get<component::bounding>();
+		if (!sync_proxy<component::render_object>(w, e, b, cursor)){
+			sync_proxy<component::hitch>(w, e, b, cursor);
+		}
+	}
+	lua_pushboolean(L, !objs.changed.empty());
+	return 1;
+}
+
+static int
+lentity_remove(lua_State *L) {
+	auto w = getworld(L);
+	auto &objs = w->cull_cached->objs;
+	for (auto& e : ecs::select<component::REMOVED, component::render_object>(w->ecs)) {
+		objs.remove(e.get<component::render_object>().cull_idx);
+	}
+	for (auto& e : ecs::select<component::REMOVED, component::hitch>(w->ecs)) {
+		objs.remove(e.get<component::hitch>().cull_idx);
+	}
+	return 0;
+}
+
+static bool
+ray_aabb(const float *o, const float *invd, const tree_aabb &b, float maxdist, float &t){
+	float tmin = 0.f, tmax = maxdist;
+	for (int ii=0; ii<3; ++ii){
+		float t1 = (b.minv[ii] - o[ii]) * invd[ii];
+		float t2 = (b.maxv[ii] - o[ii]) * invd[ii];
+		if (t1 > t2)
+			std::swap(t1, t2);
+		tmin = std::max(tmin, t1);
+		tmax = std::min(tmax, t2);
+		if (tmin > tmax)
+			return false;
+	}
+	t = tmin;
+	return true;
+}
+
+// 1: ray origin(vec4), 2: ray direction(vec4), 3: max distance, optional
+// return eids hit by the ray sorted by distance, and their distances
+static int
+lraycast(lua_State *L) {
+	auto w = getworld(L);
+	const float *origin = math_value(w->math3d->M, math3d_from_lua_id(L, w->math3d, 1));
+	const float *dir = math_value(w->math3d->M, math3d_from_lua_id(L, w->math3d, 2));
+	const float maxdist = (float)luaL_optnumber(L, 3, HUGE_VALF);
+	float invd[3];
+	for (int ii=0; ii<3; ++ii){
+		invd[ii] = 1.f / dir[ii];
+	}
+
+	const auto &objs = w->cull_cached->objs;
+	std::vector<std::pair<float, uint64_t>> hits;
+	objs.tree.query(
+		[&](const tree_aabb &b){ float t; return ray_aabb(origin, invd, b, maxdist, t) ? 0 : -1; },
+		[&](int proxy, bool){
+			float t;
+			if (ray_aabb(origin, invd, objs.tree.get(proxy).box, maxdist, t)){
+				hits.emplace_back(t, objs.objects[proxy].eid);
+			}
+		});
+	std::sort(hits.begin(), hits.end());
+
+	lua_createtable(L, (int)hits.size(), 0);
+	lua_createtable(L, (int)hits.size(), 0);
+	for (size_t ii=0; ii<hits.size(); ++ii){
+		lua_pushinteger(L, (lua_Integer)hits[ii].second);
+		lua_seti(L, -3, ii+1);
+		lua_pushnumber(L, hits[ii].first);
+		lua_seti(L, -2, ii+1);
+	}
+	return 2;
+}
+
+// 1: aabb
+// return eids which scene_aabb intersect with the aabb
+static int
+lquery_aabb(lua_State *L) {
+	auto w = getworld(L);
+	const tree_aabb q = to_tree_aabb(w, math3d_from_lua_id(L, w->math3d, 1));
+	const auto &objs = w->cull_cached->objs;
+
+	lua_newtable(L);
+	lua_Integer n = 0;
+	objs.tree.query(
+		[&q](const tree_aabb &b){ return q.contains(b) ? 1 : (q.overlap(b) ? 0 : -1); },
+		[&](int proxy, bool){
+			lua_pushinteger(L, (lua_Integer)objs.objects[proxy].eid);
+			lua_seti(L, -2, ++n);
+		});
+	return 1;
+}
+
+static int
+ltree_stat(lua_State *L) {
+	auto w = getworld(L);
+	const auto &objs = w->cull_cached->objs;
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, objs.tree.size());
+	lua_setfield(L, -2, "objects");
+	lua_pushinteger(L, objs.tree.height());
+	lua_setfield(L, -2, "height");
+	lua_pushinteger(L, objs.tree.capacity());
+	lua_setfield(L, -2, "nodes");
+	lua_pushinteger(L, objs.visible.size());
+	lua_setfield(L, -2, "visible");
+	return 1;
+}
+
 extern "C" int
 luaopen_system_cull(lua_State *L) {
 	luaL_checkversion(L);
@@ -130,6 +690,12 @@ luaopen_system_cull(lua_State *L) {
 		{ "init", linit },
 		{ "exit", lexit },
 		{ "cull", lcull },
+		{ "workers", lworkers },
+		{ "update", lupdate },
+		{ "entity_remove", lentity_remove },
+		{ "raycast", lraycast },
+		{ "query_aabb", lquery_aabb },
+		{ "tree_stat", ltree_stat },
 		{ NULL, NULL },
 	};
 	luaL_newlibtable(L,l);
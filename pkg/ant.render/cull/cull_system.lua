@@ -6,6 +6,7 @@ local math3d				= require "math3d"
 local queuemgr				= ecs.require "queue_mgr"
 local setting				= import_package "ant.settings"
 local disable_cull<const>	= setting:get "graphic/disable_cull"
+local CULL_WORKERS<const>	= setting:get "graphic/cull/workers" or 1
 
 local cullcore = world:clibs "cull.core"
 
@@ -21,7 +22,11 @@ end})
 
 local cull_sys = ecs.system "cull_system"
 
-cull_sys.init = cullcore.init
+function cull_sys:init()
+	cullcore.init()
+	cullcore.workers(CULL_WORKERS)
+end
+
 cull_sys.exit = cullcore.exit
 
 local function build_cull_args()
@@ -34,12 +39,18 @@ local function build_cull_args()
 	end
 end
 
+function cull_sys:entity_remove()
+	cullcore.entity_remove()
+end
+
 function cull_sys:cull()
 	if disable_cull then
 		return
 	end
 
-	if w:check "camera_changed" then
+	-- moved objects are culled again even if the camera is not changed
+	local bounding_changed = cullcore.update()
+	if bounding_changed or w:check "camera_changed" then
 		build_cull_args()
 		cullcore.cull()
 	end
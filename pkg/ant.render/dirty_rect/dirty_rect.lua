@@ -0,0 +1,19 @@
+local ecs   = ...
+
+-- changes which can't be found from entities' bounding, like ui overlays or material/light changes
+local idr = {
+    full = true,
+    rects = {},
+}
+
+function idr.full_redraw()
+    idr.full = true
+end
+
+-- x, y, w, h in [0, 1] of main view, origin is top left
+function idr.mark(x, y, w, h)
+    local r = idr.rects
+    r[#r+1] = x; r[#r+1] = y; r[#r+1] = w; r[#r+1] = h
+end
+
+return idr
@@ -0,0 +1,210 @@
+local ecs   = ...
+local world = ecs.world
+local w     = world.w
+
+local setting = import_package "ant.settings"
+local ENABLE_DIRTY_RECT<const>  = setting:get "graphic/dirty_rect/enable"
+local ENABLE_TAA<const>         = setting:get "graphic/postprocess/taa/enable"
+local drsys = ecs.system "dirty_rect_system"
+-- taa jitters the projection every frame, nothing stays still
+if not ENABLE_DIRTY_RECT or ENABLE_TAA then
+    return
+end
+
+local FULL_RATIO<const>         = setting:get "graphic/dirty_rect/full_ratio" or 0.5
+local ENABLE_PRE_DEPTH<const>   = not setting:get "graphic/disable_pre_z"
+local ENABLE_SHADOW<const>      = setting:get "graphic/shadow/enable"
+
+local bgfx      = require "bgfx"
+local hwi       = import_package "ant.hwi"
+local mc        = import_package "ant.math".constant
+
+local irender   = ecs.require "ant.render|render_system.render"
+local irq       = ecs.require "ant.render|render_system.renderqueue"
+local idr       = ecs.require "ant.render|dirty_rect.dirty_rect"
+
+local RM        = ecs.require "ant.material|material"
+local R         = world:clibs "render.render_material"
+local tc        = world:clibs "render.tileculling"
+
+local main_viewid<const>        = hwi.viewid_get "main_view"
+local pre_depth_viewid<const>   = hwi.viewid_get "pre_depth"
+-- clear the dirty rect of main framebuffer before pre_depth, view clear ignores scissor
+local clear_viewid<const>       = hwi.viewid_generate("dirty_rect_clear", "ibl_SH_readback")
+
+local S
+-- last screen rect of each bounded entity (render objects and hitches), they should be redrawn when the entity moves away or is removed
+local object_rects = {}
+local partial = false
+-- material instance/render material changes have no bounding change, redraw everything when they change
+local material_version, render_material_version
+
+function drsys:init()
+    S = tc.new()
+end
+
+function drsys:exit()
+    if S then
+        S:release()
+        S = nil
+    end
+end
+
+local vr_mb = world:sub{"view_rect_changed", "main_queue"}
+
+local function mark_rect(eid)
+    local r = object_rects[eid]
+    if r then
+        S:change(r[1], r[2], r[3], r[4])
+    end
+end
+
+local function update_rect(eid, viewprojmat, aabb)
+    if aabb == mc.NULL then
+        object_rects[eid] = nil
+        return
+    end
+    local x, y, ww, hh = tc.project_aabb(viewprojmat, aabb)
+    if x then
+        S:change(x, y, ww, hh)
+        local r = object_rects[eid]
+        if r then
+            r[1], r[2], r[3], r[4] = x, y, ww, hh
+        else
+            object_rects[eid] = {x, y, ww, hh}
+        end
+    else
+        object_rects[eid] = nil
+    end
+end
+
+local function update_all_rects(viewprojmat)
+    for e in w:select "bounding:in eid:in" do
+        update_rect(e.eid, viewprojmat, e.bounding.scene_aabb)
+    end
+end
+
+local function union_clear(a, b)
+    local r = a
+    for c in b:gmatch "." do
+        if not r:find(c, 1, true) then
+            r = r .. c
+        end
+    end
+    return r
+end
+
+local function restore_full()
+    if not partial then
+        return
+    end
+    partial = false
+    local mcs = irq.clear_state "main_queue"
+    bgfx.set_view_clear(main_viewid, mcs.clear, mcs.color, mcs.depth, mcs.stencil)
+    bgfx.set_view_scissor(main_viewid)
+    if ENABLE_PRE_DEPTH then
+        local dcs = irq.clear_state "pre_depth_queue"
+        bgfx.set_view_clear(pre_depth_viewid, dcs.clear, dcs.color, dcs.depth, dcs.stencil)
+        bgfx.set_view_scissor(pre_depth_viewid)
+    end
+end
+
+local function redraw_partial(vr, x, y, ww, hh)
+    local px, py = vr.x + math.floor(x * vr.w), vr.y + math.floor(y * vr.h)
+    local pw, ph = math.max(1, math.ceil(ww * vr.w)), math.max(1, math.ceil(hh * vr.h))
+
+    if not partial then
+        partial = true
+        local mcs = irq.clear_state "main_queue"
+        local clear, depth, stencil = mcs.clear, mcs.depth, mcs.stencil
+        if ENABLE_PRE_DEPTH then
+            local dcs = irq.clear_state "pre_depth_queue"
+            clear, depth, stencil = union_clear(clear, dcs.clear), dcs.depth, dcs.stencil
+        end
+        irender.set_view_frame_buffer(clear_viewid, irq.frame_buffer "main_queue")
+        bgfx.set_view_clear(clear_viewid, clear, mcs.color, depth or 0, stencil or 0)
+        bgfx.set_view_clear(main_viewid, "")
+        if ENABLE_PRE_DEPTH then
+            bgfx.set_view_clear(pre_depth_viewid, "")
+        end
+    end
+
+    bgfx.set_view_rect(clear_viewid, px, py, pw, ph)
+    bgfx.touch(clear_viewid)
+    bgfx.set_view_scissor(main_viewid, px, py, pw, ph)
+    if ENABLE_PRE_DEPTH then
+        bgfx.set_view_scissor(pre_depth_viewid, px, py, pw, ph)
+    end
+end
+
+-- visible_state_changed is cleared before render_preprocess
+function drsys:follow_scene_update()
+    for _ in w:select "visible_state_changed" do
+        idr.full_redraw()
+        break
+    end
+end
+
+function drsys:entity_remove()
+    for e in w:select "REMOVED bounding eid:in" do
+        mark_rect(e.eid)
+        object_rects[e.eid] = nil
+    end
+end
+
+function drsys:render_preprocess()
+    for _ in vr_mb:each() do
+        idr.full_redraw()
+    end
+    if irq.main_camera_changed() then
+        idr.full_redraw()
+    end
+    local mv, rv = RM.version(), R.version()
+    if mv ~= material_version or rv ~= render_material_version then
+        material_version, render_material_version = mv, rv
+        idr.full_redraw()
+    end
+
+    local camera = irq.main_camera_entity "camera:in".camera
+    if idr.full then
+        idr.full = false
+        update_all_rects(camera.viewprojmat)
+        S:reset()
+        restore_full()
+        return
+    end
+
+    for e in w:select "bounding_changed bounding:in eid:in cast_shadow?in" do
+        if ENABLE_SHADOW and e.cast_shadow then
+            -- the shadow can be anywhere on the screen
+            idr.full_redraw()
+        end
+        mark_rect(e.eid)
+        update_rect(e.eid, camera.viewprojmat, e.bounding.scene_aabb)
+    end
+
+    local rects = idr.rects
+    for i=1, #rects, 4 do
+        S:change(rects[i], rects[i+1], rects[i+2], rects[i+3])
+        rects[i], rects[i+1], rects[i+2], rects[i+3] = nil, nil, nil, nil
+    end
+
+    local n, x, y, ww, hh = S:submit()
+    S:reset()
+
+    if idr.full then
+        idr.full = false
+        restore_full()
+        return
+    end
+
+    local vr = irq.view_rect "main_queue"
+    if n == 0 then
+        -- nothing changed, keep the views alive with a 1x1 scissor
+        redraw_partial(vr, 0, 0, 0, 0)
+    elseif ww * hh >= FULL_RATIO then
+        restore_full()
+    else
+        redraw_partial(vr, x, y, ww, hh)
+    end
+end
@@ -7,6 +7,7 @@ local mathpkg   = import_package "ant.math"
 local mc, mu    = mathpkg.constant, mathpkg.util
 local ig        = ecs.require "ant.group|group"
 local Q         = world:clibs "render.queue"
+local RS        = world:clibs "system.render"
 local ivs       = ecs.require "ant.render|visible_state"
 local hwi       = import_package "ant.hwi"
 local idi       = ecs.require "ant.render|draw_indirect.draw_indirect"
@@ -237,6 +238,7 @@ function hitch_sys:refine_camera()
             for re in w:select "hitch_tag eid:in mesh_result:in draw_indirect:in render_object_visible?update" do
                 -- render_object_visible only set in render_system entity_init by view_visible
                 re.render_object_visible = true
+                RS.submit_invalidate()
                 glbs[#glbs+1] = { diid = re.eid}
                 update_instance_buffer(re.eid, memory, draw_num)
             end
@@ -10,6 +10,7 @@ local bgfx		= require "bgfx"
 local iom		= ecs.require "ant.objcontroller|obj_motion"
 local iexposure = ecs.require "ant.camera|exposure"
 local imaterial = ecs.require "ant.asset|material"
+local idr		= ecs.require "ant.render|dirty_rect.dirty_rect"
 
 local setting	= import_package "ant.settings"
 local enable_cluster_shading = setting:get "graphic/lighting/cluster_shading" ~= 0
@@ -360,6 +361,7 @@ end
 function lightsys:update_system_properties()
 	if isChanged() then
 		update_light_buffers()
+		idr.full_redraw()
 	end
 end
 
@@ -23,7 +23,10 @@ lm:lua_source "render_core"{
         "render/render.cpp",
         "render/hash.cpp",
         "render/queue.cpp",
+        "render/tileculling.c",
+        "render/ltileculling.c",
     },
+    deps = "foundation",
 }
 
 lm:lua_source "render" {
@@ -33,12 +36,14 @@ lm:lua_source "render" {
         lm.AntDir .. "/3rd/luaecs",
         lm.AntDir .. "/3rd/glm",
         lm.AntDir .. "/clibs/ecs",
+        lm.AntDir .. "/clibs/foundation",
     },
     defines = {
         "GLM_FORCE_QUAT_DATA_XYZW",
     },
     sources = {
         "cull/cull.cpp",
+        "cull/aabb_tree.cpp",
     },
     objdeps = "compile_ecs",
     deps = {
@@ -18,7 +18,8 @@ local function init_bounding(bounding, bb)
 end
 
 function b:entity_init()
-	for e in w:select "INIT mesh_result:in bounding:update" do
+	for e in w:select "INIT mesh_result:in bounding:update bounding_changed?out" do
 		init_bounding(e.bounding, e.mesh_result.bounding)
+		e.bounding_changed = true
 	end
 end
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "ecs/world.h"
+#include "math3d.h"
+#include "tileculling.h"
+
+#define SCREEN_META "TILECULLING_SCREEN"
+
+static struct screen *
+getscreen(lua_State *L) {
+	struct screen **S = (struct screen **)luaL_checkudata(L, 1, SCREEN_META);
+	if (*S == NULL)
+		luaL_error(L, "screen is released");
+	return *S;
+}
+
+// x, y, w, h in [0, 1], origin is top left
+static void
+getrect(lua_State *L, int index, float rect[4]) {
+	int i;
+	for (i=0;i<4;i++) {
+		rect[i] = (float)luaL_checknumber(L, index+i);
+	}
+}
+
+static int
+lscreen_change(lua_State *L) {
+	struct screen *S = getscreen(L);
+	float rect[4];
+	getrect(L, 2, rect);
+	screen_change(S, rect);
+	return 0;
+}
+
+static int
+lscreen_changeless(lua_State *L) {
+	struct screen *S = getscreen(L);
+	float rect[4];
+	getrect(L, 2, rect);
+	int id = screen_changeless(S, rect);
+	if (id < 0)
+		return 0;
+	lua_pushinteger(L, id);
+	return 1;
+}
+
+static int
+lscreen_query(lua_State *L) {
+	struct screen *S = getscreen(L);
+	lua_pushboolean(L, screen_query(S, (int)luaL_checkinteger(L, 2)));
+	return 1;
+}
+
+// return the number of dirty tiles, and the bounding rect of them
+static int
+lscreen_submit(lua_State *L) {
+	struct screen *S = getscreen(L);
+	screen_submit(S);
+	const int size = screen_masksize(S);
+	const unsigned char *mask = screen_mask(S);
+	int n = 0;
+	int x1 = size, y1 = size, x2 = -1, y2 = -1;
+	int i, j;
+	for (i=0;i<size;i++) {
+		for (j=0;j<size;j++) {
+			if (mask[i*size+j]) {
+				++n;
+				if (j < x1) x1 = j;
+				if (j > x2) x2 = j;
+				if (i < y1) y1 = i;
+				if (i > y2) y2 = i;
+			}
+		}
+	}
+	lua_pushinteger(L, n);
+	if (n == 0)
+		return 1;
+	const float unit = 1.0f / size;
+	lua_pushnumber(L, x1 * unit);
+	lua_pushnumber(L, y1 * unit);
+	lua_pushnumber(L, (x2 - x1 + 1) * unit);
+	lua_pushnumber(L, (y2 - y1 + 1) * unit);
+	return 5;
+}
+
+static int
+lscreen_reset(lua_State *L) {
+	screen_reset(getscreen(L));
+	return 0;
+}
+
+static int
+lscreen_mask(lua_State *L) {
+	struct screen *S = getscreen(L);
+	lua_pushlightuserdata(L, (void *)screen_mask(S));
+	lua_pushinteger(L, screen_masksize(S));
+	return 2;
+}
+
+static int
+lscreen_release(lua_State *L) {
+	struct screen **S = (struct screen **)luaL_checkudata(L, 1, SCREEN_META);
+	if (*S) {
+		screen_delete(*S);
+		*S = NULL;
+	}
+	return 0;
+}
+
+static int
+lnew(lua_State *L) {
+	struct screen **S = (struct screen **)lua_newuserdatauv(L, sizeof(struct screen *), 0);
+	*S = NULL;
+	if (luaL_newmetatable(L, SCREEN_META)) {
+		luaL_Reg l[] = {
+			{ "change",		lscreen_change },
+			{ "changeless",	lscreen_changeless },
+			{ "query",		lscreen_query },
+			{ "submit",		lscreen_submit },
+			{ "reset",		lscreen_reset },
+			{ "mask",		lscreen_mask },
+			{ "release",	lscreen_release },
+			{ "__gc",		lscreen_release },
+			{ "__index",	NULL },
+			{ NULL, NULL },
+		};
+		luaL_setfuncs(L, l, 0);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+	}
+	lua_setmetatable(L, -2);
+	*S = screen_new();
+	if (*S == NULL)
+		return luaL_error(L, "Out of memory");
+	return 1;
+}
+
+static inline float
+clamp01(float v) {
+	return v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+}
+
+// project an aabb with viewprojmat, return the screen rect (x, y, w, h in [0, 1]) or nil if it's out of screen
+static int
+lproject_aabb(lua_State *L) {
+	struct ecs_world *w = getworld(L);
+	struct math_context *M = w->math3d->M;
+	const float *vp = math_value(M, math3d_from_lua_id(L, w->math3d, 1));
+	const float *aabb = math_value(M, math3d_from_lua_id(L, w->math3d, 2));
+	float minx = 1.f, miny = 1.f, maxx = -1.f, maxy = -1.f;
+	int i;
+	for (i=0;i<8;i++) {
+		const float x = (i & 1) ? aabb[4] : aabb[0];
+		const float y = (i & 2) ? aabb[5] : aabb[1];
+		const float z = (i & 4) ? aabb[6] : aabb[2];
+		const float cx = vp[0] * x + vp[4] * y + vp[8]  * z + vp[12];
+		const float cy = vp[1] * x + vp[5] * y + vp[9]  * z + vp[13];
+		const float cw = vp[3] * x + vp[7] * y + vp[11] * z + vp[15];
+		if (cw <= 1e-6f) {
+			// cross the near plane, take the whole screen
+			minx = miny = -1.f;
+			maxx = maxy = 1.f;
+			break;
+		}
+		const float nx = cx / cw, ny = cy / cw;
+		if (i == 0) {
+			minx = maxx = nx;
+			miny = maxy = ny;
+		} else {
+			if (nx < minx) minx = nx;
+			if (nx > maxx) maxx = nx;
+			if (ny < miny) miny = ny;
+			if (ny > maxy) maxy = ny;
+		}
+	}
+	if (maxx < -1.f || minx > 1.f || maxy < -1.f || miny > 1.f)
+		return 0;
+	const float x1 = clamp01((minx + 1.f) * 0.5f), x2 = clamp01((maxx + 1.f) * 0.5f);
+	const float y1 = clamp01((1.f - maxy) * 0.5f), y2 = clamp01((1.f - miny) * 0.5f);
+	lua_pushnumber(L, x1);
+	lua_pushnumber(L, y1);
+	lua_pushnumber(L, x2 - x1);
+	lua_pushnumber(L, y2 - y1);
+	return 4;
+}
+
+LUAMOD_API int
+luaopen_render_tileculling(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "new",			lnew },
+		{ "project_aabb",	lproject_aabb },
+		{ NULL, NULL },
+	};
+	luaL_newlibtable(L, l);
+	lua_pushnil(L);
+	luaL_setfuncs(L, l, 1);
+	return 1;
+}
@@ -1,140 +1,28 @@
 #include "lua.hpp"
 #include "queue.h"
 
-#include <cstdint>
-#include <vector>
-#include <forward_list>
-
-#include <cassert>
-
 #include "ecs/world.h"
 
-struct queue_node {
-	static constexpr uint8_t NUM_MASK = MAX_VISIBLE_QUEUE / 64;
-	uint64_t masks[NUM_MASK] = {0};
-
-    constexpr void clear() {
-        for (uint32_t ii=0; ii<NUM_MASK; ++ii){
-            masks[ii] = 0;
-        }
-    }
-
-    constexpr void fetch(uint64_t *outmasks) const {
-        for (int ii=0; ii<NUM_MASK; ++ii){
-            outmasks[ii] = masks[ii];
-        }
-    }
-
-    bool check(uint8_t queue) const {
-        const uint8_t eidx = queue / 64;
-        const uint8_t sidx = queue % 64;
-        assert(eidx < NUM_MASK && "Max queue is 64");
-
-        return 0 != (masks[eidx] & (1ull << sidx));
-    }
-
-    void set(uint8_t queue, bool value){
-        const uint8_t eidx = queue / 64;
-        assert(eidx < NUM_MASK && "Max queue is 64");
-        const uint8_t sidx = queue % 64;
-
-        if (value){
-            masks[eidx] |= (1ull << sidx);
-        } else {
-            masks[eidx] &= ~(1ull << sidx);
-        }
-    }
-
-    void set(queue_node &n, bool value) {
-        if (value){
-            for(uint8_t ii=0; ii<NUM_MASK; ++ii){
-                masks[ii] |= n.masks[ii];
-            }
-        } else {
-            for(uint8_t ii=0; ii<NUM_MASK; ++ii){
-                masks[ii] &= ~(n.masks[ii]);
-            }
-        }
-    }
-};
-
-struct queue_container {
-    queue_container(int c): nodes(c){}
-    int alloc(){
-        if (!freelist.empty()){
-            const int Qidx = freelist.front();
-            freelist.pop_front();
-            nodes[Qidx].clear();
-            return Qidx;
-        }
-
-        const int Qidx = n++;
-        if (n == (int)nodes.size()){
-            nodes.resize(n*2);
-        }
-        return Qidx;
-    }
-
-    void dealloc(int Qidx){
-        freelist.push_front(Qidx);
-    }
-
-    inline bool isvalid(int Qidx) const {
-        return 0 <= Qidx && Qidx < n;
-    }
-
-    inline void fetch(int Qidx, uint64_t *outmask) const {
-        return nodes[Qidx].fetch(outmask);
-    }
-
-    inline bool check(int Qidx, uint8_t queue) const {
-        return nodes[Qidx].check(queue);
-    }
-
-    inline void set(int Qidx, uint8_t queue, bool value) {
-        nodes[Qidx].set(queue, value);
-    }
-
-    inline void set(int Qidx, int nextQidx, bool value) {
-        nodes[Qidx].set(nodes[nextQidx], value);
-    }
-
-    std::vector<queue_node> nodes;
-    std::forward_list<int>   freelist;
-    int n = 0;
-};
-
 struct queue_container* queue_create(){
-    return new struct queue_container(256);
+	auto Q = new struct queue_container;
+	Q->nodes.resize(256);
+	Q->links.resize(256, QUEUE_NODE_USED);
+	return Q;
 }
 
 void queue_destroy(struct queue_container* Q){
-    delete Q;
-}
-
-bool queue_check(struct queue_container* Q, int Qidx, uint8_t queue){
-    return Q->check(Qidx, queue);
-}
-
-void queue_set(struct queue_container* Q, int Qidx, uint8_t queue, bool value){
-    return Q->set(Qidx, queue, value);
-}
-
-void queue_set_by_index(struct queue_container *Q, int Qidx, int nextQidx, bool value){
-    return Q->set(Qidx, nextQidx, value);
-}
-
-void queue_fetch(struct queue_container* Q, int Qidx, uint64_t *outmasks){
-    return Q->fetch(Qidx, outmasks);
+	delete Q;
 }
 
 int
 queue_dealloc(struct queue_container* Q, int Qidx){
-    if (Q->isvalid(Qidx)){
-        Q->dealloc(Qidx);
-        return 1;
-    }
-    return 0;
+	if (!queue_isvalid(Q, Qidx))
+		return 0;
+	Q->nodes[Qidx] = queue_node{};
+	Q->links[Qidx] = Q->freelist;
+	Q->freelist = Qidx;
+	queue_changed(Q);
+	return 1;
 }
 
 static int
@@ -149,7 +37,20 @@ lqueue_dealloc(lua_State *L){
 
 int
 queue_alloc(struct queue_container* Q){
-    return Q->alloc();
+	queue_changed(Q);
+	if (Q->freelist >= 0){
+		const int Qidx = Q->freelist;
+		Q->freelist = Q->links[Qidx];
+		Q->links[Qidx] = QUEUE_NODE_USED;
+		return Qidx;
+	}
+
+	const int Qidx = Q->n++;
+	if (Q->n == (int)Q->nodes.size()){
+		Q->nodes.resize(Q->n*2);
+		Q->links.resize(Q->n*2, QUEUE_NODE_USED);
+	}
+	return Qidx;
 }
 
 static int
@@ -163,7 +64,7 @@ static int
 lqueue_set(lua_State *L){
     auto w = getworld(L);
     const int Qidx = (int)luaL_checkinteger(L, 1);
-    if (!w->Q->isvalid(Qidx)){
+    if (!queue_isvalid(w->Q, Qidx)){
         luaL_error(L, "Invalid Qidx");
     }
 
@@ -177,7 +78,7 @@ static int
 lqueue_check(lua_State *L){
     auto w = getworld(L);
     const int Qidx = (int)luaL_checkinteger(L, 1);
-    if (!w->Q->isvalid(Qidx)){
+    if (!queue_isvalid(w->Q, Qidx)){
         luaL_error(L, "Invalid Qidx");
     }
 
@@ -186,6 +87,19 @@ lqueue_check(lua_State *L){
     return 1;
 }
 
+// visible(visible_idx, cull_idx, queue), an invalid cull_idx means the object is never culled
+static int
+lqueue_visible(lua_State *L){
+    auto w = getworld(L);
+    const int visible_idx = (int)luaL_checkinteger(L, 1);
+    const int cull_idx = (int)luaL_checkinteger(L, 2);
+    const uint8_t queue = (uint8_t)luaL_checkinteger(L, 3);
+    const bool visible = queue_isvalid(w->Q, visible_idx) && queue_check(w->Q, visible_idx, queue)
+        && !(queue_isvalid(w->Q, cull_idx) && queue_check(w->Q, cull_idx, queue));
+    lua_pushboolean(L, visible);
+    return 1;
+}
+
 extern "C" int
 luaopen_render_queue(lua_State *L){
 	luaL_checkversion(L);
@@ -194,6 +108,7 @@ luaopen_render_queue(lua_State *L){
 		{ "alloc",	lqueue_alloc},
 		{ "set",	lqueue_set},
         { "check",  lqueue_check},
+        { "visible",lqueue_visible},
 		{ nullptr, 	nullptr },
 	};
 	luaL_newlibtable(L,l);
@@ -1,15 +1,203 @@
 #pragma once
 
 #include <cstdint>
-
+#include <cassert>
+#include <vector>
+#include <atomic>
+#include <bit>
 
 #define MAX_VISIBLE_QUEUE   64
-struct queue_container;
+
+struct queue_node {
+	static constexpr uint8_t NUM_MASK = MAX_VISIBLE_QUEUE / 64;
+	uint64_t masks[NUM_MASK] = {0};
+};
+
+// links[Qidx] of an allocated node, the free nodes keep the next free index (-1 is the end)
+static constexpr int QUEUE_NODE_USED = -2;
+
+// the nodes are only resized by queue_alloc on the world thread,
+// the mask writers use atomic ops, so cull workers can update nodes concurrently (even the same node).
+// the free list is kept out of nodes, so the masks of a freed node stay zero
+struct queue_container {
+	std::vector<queue_node>	nodes;
+	std::vector<int>		links;
+	int						n = 0;
+	int						freelist = -1;
+	// increased whenever any mask is changed, used to detect visible/cull changes
+	std::atomic<uint64_t>	version{0};
+};
+
 struct queue_container* queue_create();
 void queue_destroy(struct queue_container*);
 int queue_alloc(struct queue_container* Q);
 int queue_dealloc(struct queue_container* Q, int Qidx);
-bool queue_check(struct queue_container* Q, int Qidx, uint8_t queue);
-void queue_set(struct queue_container* Q, int Qidx, uint8_t queue, bool value);
-void queue_set_by_index(struct queue_container *Q, int Qidx, int nextQidx, bool value);
-void queue_fetch(struct queue_container* Q, int Qidx, uint64_t *outmasks);
\ No newline at end of file
+
+static inline bool
+queue_isvalid(const struct queue_container* Q, int Qidx){
+	return 0 <= Qidx && Qidx < Q->n && Q->links[Qidx] == QUEUE_NODE_USED;
+}
+
+static inline uint64_t
+queue_version(const struct queue_container* Q){
+	return Q->version.load(std::memory_order_relaxed);
+}
+
+static inline void
+queue_changed(struct queue_container* Q){
+	Q->version.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline bool
+queue_check(const struct queue_container* Q, int Qidx, uint8_t queue){
+	assert(queue < MAX_VISIBLE_QUEUE && "Max queue is 64");
+	return 0 != (Q->nodes[Qidx].masks[queue / 64] & (1ull << (queue % 64)));
+}
+
+static inline void
+queue_fetch(const struct queue_container* Q, int Qidx, uint64_t *outmasks){
+	const queue_node &n = Q->nodes[Qidx];
+	for (uint8_t ii=0; ii<queue_node::NUM_MASK; ++ii){
+		outmasks[ii] = n.masks[ii];
+	}
+}
+
+// return the old value
+static inline uint64_t
+queue_mask_or(uint64_t &m, uint64_t v){
+	return std::atomic_ref<uint64_t>(m).fetch_or(v, std::memory_order_relaxed);
+}
+
+static inline uint64_t
+queue_mask_and(uint64_t &m, uint64_t v){
+	return std::atomic_ref<uint64_t>(m).fetch_and(v, std::memory_order_relaxed);
+}
+
+static inline void
+queue_set(struct queue_container* Q, int Qidx, uint8_t queue, bool value){
+	assert(queue < MAX_VISIBLE_QUEUE && "Max queue is 64");
+	uint64_t &m = Q->nodes[Qidx].masks[queue / 64];
+	const uint64_t bit = 1ull << (queue % 64);
+	const uint64_t old = value ? queue_mask_or(m, bit) : queue_mask_and(m, ~bit);
+	if ((old & bit) != (value ? bit : 0))
+		queue_changed(Q);
+}
+
+// set/clear all the bits of nextQidx in Qidx
+static inline void
+queue_set_by_index(struct queue_container *Q, int Qidx, int nextQidx, bool value){
+	uint64_t v[queue_node::NUM_MASK];
+	queue_fetch(Q, nextQidx, v);
+	queue_node &n = Q->nodes[Qidx];
+	bool changed = false;
+	for (uint8_t ii=0; ii<queue_node::NUM_MASK; ++ii){
+		const uint64_t old = value ? queue_mask_or(n.masks[ii], v[ii]) : queue_mask_and(n.masks[ii], ~v[ii]);
+		changed |= value ? (old | v[ii]) != old : (old & ~v[ii]) != old;
+	}
+	if (changed)
+		queue_changed(Q);
+}
+
+// replace the bits selected by masks with values, both have MAX_VISIBLE_QUEUE/64 elements
+static inline void
+queue_update(struct queue_container* Q, int Qidx, const uint64_t *masks, const uint64_t *values){
+	queue_node &n = Q->nodes[Qidx];
+	bool changed = false;
+	for (uint8_t ii=0; ii<queue_node::NUM_MASK; ++ii){
+		std::atomic_ref<uint64_t> m(n.masks[ii]);
+		uint64_t old = m.load(std::memory_order_relaxed);
+		uint64_t v;
+		do {
+			v = (old & ~masks[ii]) | (values[ii] & masks[ii]);
+		} while (v != old && !m.compare_exchange_weak(old, v, std::memory_order_relaxed));
+		changed |= v != old;
+	}
+	if (changed)
+		queue_changed(Q);
+}
+
+// bulk ops, nodes[Qidx[i]] &= masks for i in [0, n)
+static inline void
+queue_and(struct queue_container* Q, const int *Qidx, uint32_t n, const uint64_t *masks){
+	bool changed = false;
+	for (uint32_t ii=0; ii<n; ++ii){
+		queue_node &node = Q->nodes[Qidx[ii]];
+		for (uint8_t mi=0; mi<queue_node::NUM_MASK; ++mi){
+			changed |= 0 != (queue_mask_and(node.masks[mi], masks[mi]) & ~masks[mi]);
+		}
+	}
+	if (changed)
+		queue_changed(Q);
+}
+
+// nodes[Qidx[i]] &= ~masks for i in [0, n)
+static inline void
+queue_andnot(struct queue_container* Q, const int *Qidx, uint32_t n, const uint64_t *masks){
+	bool changed = false;
+	for (uint32_t ii=0; ii<n; ++ii){
+		queue_node &node = Q->nodes[Qidx[ii]];
+		for (uint8_t mi=0; mi<queue_node::NUM_MASK; ++mi){
+			changed |= 0 != (queue_mask_and(node.masks[mi], ~masks[mi]) & masks[mi]);
+		}
+	}
+	if (changed)
+		queue_changed(Q);
+}
+
+// set bit i of outbits when object i is visible and not culled in the queue,
+// outbits has (n+63)/64 words, return the number of selected objects, *culled is the number of visible but culled objects
+static inline uint32_t
+queue_select(const struct queue_container* Q, const int *visible_idx, const int *cull_idx, uint32_t n, uint8_t queue, uint64_t *outbits, uint32_t *culled){
+	assert(queue < MAX_VISIBLE_QUEUE && "Max queue is 64");
+	const uint8_t mi = queue / 64;
+	const uint8_t shift = queue % 64;
+	uint32_t selected = 0, nculled = 0;
+	for (uint32_t base=0; base<n; base += 64){
+		const uint32_t to = (n - base) < 64 ? (n - base) : 64;
+		uint64_t vis = 0, cul = 0;
+		for (uint32_t ii=0; ii<to; ++ii){
+			vis |= ((Q->nodes[visible_idx[base+ii]].masks[mi] >> shift) & 1) << ii;
+			cul |= ((Q->nodes[cull_idx[base+ii]].masks[mi] >> shift) & 1) << ii;
+		}
+		const uint64_t sel = vis & ~cul;
+		outbits[base / 64] = sel;
+		selected += (uint32_t)std::popcount(sel);
+		nculled += (uint32_t)std::popcount(vis & cul);
+	}
+	if (culled)
+		*culled = nculled;
+	return selected;
+}
+
+// iterate the set bits of a bitset: for (uint32_t i : queue_bits{bits, n}) {}
+struct queue_bits {
+	const uint64_t *bits;
+	uint32_t n;
+
+	struct iterator {
+		const uint64_t *bits;
+		uint32_t nword;
+		uint32_t word;
+		uint64_t cur;
+
+		void skip(){
+			while (cur == 0 && ++word < nword)
+				cur = bits[word];
+		}
+		uint32_t operator*() const { return word * 64 + (uint32_t)std::countr_zero(cur); }
+		iterator& operator++() { cur &= cur - 1; skip(); return *this; }
+		bool operator!=(const iterator &o) const { return word != o.word || cur != o.cur; }
+	};
+
+	iterator begin() const {
+		const uint32_t nword = (n + 63) / 64;
+		iterator it{bits, nword, 0, nword ? bits[0] : 0};
+		if (nword)
+			it.skip();
+		return it;
+	}
+	iterator end() const {
+		const uint32_t nword = (n + 63) / 64;
+		return iterator{bits, nword, nword, 0};
+	}
+};
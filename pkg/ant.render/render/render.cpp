@@ -12,6 +12,7 @@ extern "C"{
 
 #include "queue.h"
 #include "hash.h"
+#include "jobpool.h"
 
 #include "lua.hpp"
 #include "luabgfx.h"
@@ -25,54 +26,122 @@ extern "C"{
 #include <memory.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <mutex>
+#include <chrono>
+#include <bit>
 struct transform {
 	uint32_t tid;
 	uint32_t stride;
 };
 
-//using obj_transforms = std::unordered_map<uint64_t, transform>;
+// open addressing(linear probing) cache, keyed by (render_object, hitch matrix)
+// entries from older epoch are treat as empty, so clear() is O(1)
 struct obj_transforms {
-	static constexpr uint16_t MAX_CACHE = (16384-1);
-	struct key {
-		static uint16_t hash_idx(const component::render_object *ro, math_t m) {
-			return (uint16_t)((hash64((uint64_t)ro^m.idx)) % obj_transforms::MAX_CACHE);
-		}
+	static constexpr uint32_t MIN_CAPACITY = 256;
 
-		const component::render_object * ro;
-		math_t m;
-		uint16_t hidx;
+	struct entry {
+		const component::render_object *ro;
+		uint64_t	m;
+		uint32_t	epoch;
+		transform	value;
 	};
 
-	key			keys[MAX_CACHE] = {{0}};
-	transform	values[MAX_CACHE] = {{0}};
+	std::vector<entry>	entries;
+	uint32_t	mask = 0;
+	uint32_t	count = 0;
+	uint32_t	epoch = 1;
+
+	// accumulated, never reset, read the difference
+	uint32_t	hit = 0;
+	uint32_t	miss = 0;
+	uint32_t	allocated = 0;
+
+	static uint32_t hash(const component::render_object *ro, uint64_t m){
+		return (uint32_t)hash64((uint64_t)(uintptr_t)ro ^ m);
+	}
+
+	// keep load factor under 1/2 for n entries
+	void reserve(uint32_t n){
+		uint32_t cap = MIN_CAPACITY;
+		while (cap < n * 2){
+			cap <<= 1;
+		}
+		if (cap > entries.size()){
+			rehash(cap);
+		}
+	}
 
-	bool check(const key& k, transform &v) const {
-		const key& r = keys[k.hidx];
-		if (r.ro == k.ro && r.m.idx == k.m.idx){
-			v = values[k.hidx];
-			return true;
+	bool check(const component::render_object *ro, math_t m, transform &v) const {
+		if (entries.empty())
+			return false;
+		for (uint32_t idx = hash(ro, m.idx) & mask; entries[idx].epoch == epoch; idx = (idx+1) & mask){
+			const entry &e = entries[idx];
+			if (e.ro == ro && e.m == m.idx){
+				v = e.value;
+				return true;
+			}
 		}
 		return false;
 	}
 
-	void add(const key& k, const transform &v){
-		values[k.hidx] = v;
-		keys[k.hidx] = k;
+	void add(const component::render_object *ro, math_t m, const transform &v){
+		if ((count+1) * 2 > entries.size()){
+			rehash(entries.empty() ? MIN_CAPACITY : (uint32_t)entries.size() * 2);
+		}
+		insert(ro, m.idx, v);
 	}
 
 	void clear(){
-		memset(keys, 0, sizeof(keys));
+		count = 0;
+		if (++epoch == 0){
+			for (auto &e : entries){
+				e.epoch = 0;
+			}
+			epoch = 1;
+		}
+	}
+
+	uint32_t capacity() const {
+		return (uint32_t)entries.size();
+	}
+
+private:
+	void insert(const component::render_object *ro, uint64_t m, const transform &v){
+		uint32_t idx = hash(ro, m) & mask;
+		while (entries[idx].epoch == epoch){
+			idx = (idx+1) & mask;
+		}
+		entries[idx] = entry{ro, m, epoch, v};
+		++count;
+	}
+
+	void rehash(uint32_t cap){
+		std::vector<entry> old(cap, entry{nullptr, 0, 0, {0, 0}});
+		old.swap(entries);
+		mask = cap - 1;
+		count = 0;
+		for (const auto &e : old){
+			if (e.epoch == epoch){
+				insert(e.ro, e.m, e.value);
+			}
+		}
 	}
 };
 
 static inline transform
 update_transform(struct ecs_world* w, const component::render_object *ro, const math_t& hwm, obj_transforms &trans){
-	auto key = obj_transforms::key{ro, hwm, obj_transforms::key::hash_idx(ro, hwm)};
 	transform t;
-	if (!trans.check(key, t)){
+	if (trans.check(ro, hwm, t)){
+		++trans.hit;
+	} else {
 		const math_t wm = ro->worldmat;
 		assert(math_valid(w->math3d->M, wm) && !math_isnull(wm) && "Invalid world mat");
 		const int num = math_size(w->math3d->M, wm);
+		++trans.miss;
+		trans.allocated += num;
 
 		bgfx_transform_t bt;
 		t.tid = w->bgfx->encoder_alloc_transform(w->holder->encoder, &bt, (uint16_t)num);
@@ -85,7 +154,7 @@ update_transform(struct ecs_world* w, const component::render_object *ro, const
 			math3d_mul_matrix_array(w->math3d->M, hwm, wm, r);
 		}
 
-		trans.add(key, t);
+		trans.add(ro, hwm, t);
 	}
 
 	return t;
@@ -132,15 +201,6 @@ mesh_submit(struct ecs_world* w, const component::render_object* ro,  int vid){
 	return true;
 }
 
-static inline struct material_instance*
-get_material(struct render_material * R, uint32_t rmidx, size_t midx){
-	//TODO: get all the materials by mask
-	const uint64_t mask = 1ull << midx;
-	void* mat[64] = {nullptr};
-	render_material_fetch(R, rmidx, mask, mat);
-	return (struct material_instance*)(mat[midx]);
-}
-
 using matrix_array = std::vector<math_t>;
 
 //TODO: maybe move to another c module
@@ -157,20 +217,6 @@ submit_efk_obj(lua_State* L, struct ecs_world* w, const component::efk_object *e
 	}
 }
 
-static inline struct material_instance*
-find_submit_material(lua_State *L, struct ecs_world *w, const component::render_args *ra, uint32_t rmidx) {
-	auto mi = get_material(w->R, rmidx, ra->material_index);
-	
-	if (nullptr == mi)
-		return nullptr;
-
-	const auto prog = material_prog(L, mi);
-	if (!BGFX_HANDLE_IS_VALID(prog))
-		return nullptr;
-
-	return mi;
-}
-
 static inline bool
 find_submit_mesh(const component::render_object *ro, const component::indirect_object *io) {
 	if (ro->vb_num == 0 || (io && io->draw_num == 0))
@@ -191,7 +237,6 @@ draw_indirect_obj(lua_State *L, struct ecs_world *w, bgfx_view_id_t viewid,
 	if (io->draw_num == 0){
 		return ;
 	}
-	apply_material_instance(L, mi, w);
 	mesh_submit(w, ro, viewid);
 
 	const auto itb = bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)io->itb_handle};
@@ -213,7 +258,6 @@ draw_obj(lua_State *L, struct ecs_world *w, bgfx_view_id_t viewid,
 	const matrix_array *mats, uint8_t discardflags,
 	obj_transforms &trans){
 
-	apply_material_instance(L, mi, w);
 	mesh_submit(w, ro, viewid);
 	
 	transform t;
@@ -232,10 +276,273 @@ draw_obj(lua_State *L, struct ecs_world *w, bgfx_view_id_t viewid,
 	w->bgfx->encoder_submit(w->holder->encoder, viewid, prog, ro->render_layer, discardflags);
 }
 
+// keep state, stencil, uniforms and texture bindings for the next draw when it shares the same material instance,
+// only for sequential views: the other view modes reorder the draws, so every draw applies its own material
+static constexpr uint8_t DISCARD_KEEP_MATERIAL = BGFX_DISCARD_ALL & ~(BGFX_DISCARD_STATE|BGFX_DISCARD_BINDINGS);
+
+// | render_layer:8 | program:16 | material batch id:24 | vertex buffer:16 |
+static inline uint64_t
+submit_sortkey(const component::render_object *ro, const struct material_instance *mi, bgfx_program_handle_t prog){
+	const uint64_t layer	= std::min<uint32_t>(ro->render_layer, 0xff);
+	const uint64_t mat		= hash64(material_instance_batchid(mi)) & 0xffffff;
+	const uint64_t vb		= ro->vb_handle & 0xffff;
+	return (layer << 56) | ((uint64_t)prog.idx << 40) | (mat << 16) | vb;
+}
+
+struct submit_item {
+	uint64_t key;
+	const struct material_instance* mi;
+	bgfx_program_handle_t prog;
+	uint32_t idx;
+};
+
+using submit_items = std::vector<submit_item>;
+
+// LSD radix sort by submit_item::key, stable, 8 bits per pass, skip the passes that all keys share the same byte
+static void
+radix_sort(submit_items &items, submit_items &temp){
+	const size_t n = items.size();
+	if (n < 2)
+		return;
+
+	uint32_t counts[8][256] = {{0}};
+	for (const auto &it : items){
+		for (int p=0; p<8; ++p){
+			++counts[p][(it.key >> (p*8)) & 0xff];
+		}
+	}
+
+	temp.resize(n);
+	submit_item *src = items.data(), *dst = temp.data();
+	for (int p=0; p<8; ++p){
+		uint32_t *c = counts[p];
+		if (c[(src[0].key >> (p*8)) & 0xff] == n)
+			continue;
+
+		uint32_t offset = 0;
+		for (int b=0; b<256; ++b){
+			const uint32_t cc = c[b];
+			c[b] = offset;
+			offset += cc;
+		}
+		for (size_t ii=0; ii<n; ++ii){
+			dst[c[(src[ii].key >> (p*8)) & 0xff]++] = src[ii];
+		}
+		std::swap(src, dst);
+	}
+
+	if (src != items.data()){
+		items.swap(temp);
+	}
+}
+
+static inline uint8_t
+submit_discardflags(const component::render_args *ra, const submit_items &items, size_t idx){
+	return (ra->sequential && idx+1 < items.size() && material_instance_equal(items[idx+1].mi, items[idx].mi)) ? DISCARD_KEEP_MATERIAL : BGFX_DISCARD_ALL;
+}
+
+static inline bool
+submit_reapply(const component::render_args *ra, const struct material_instance *mi, const struct material_instance *applied){
+	return !ra->sequential || applied == nullptr || !material_instance_equal(mi, applied);
+}
+
+static inline bool
+same_mesh(const component::render_object *lhs, const component::render_object *rhs){
+	return	lhs->vb_handle	== rhs->vb_handle	&& lhs->vb_start	== rhs->vb_start	&& lhs->vb_num	== rhs->vb_num	&&
+			lhs->vb2_handle	== rhs->vb2_handle	&& lhs->vb2_start	== rhs->vb2_start	&& lhs->vb2_num	== rhs->vb2_num	&&
+			lhs->ib_handle	== rhs->ib_handle	&& lhs->ib_start	== rhs->ib_start	&& lhs->ib_num	== rhs->ib_num	&&
+			lhs->render_layer == rhs->render_layer;
+}
+
+// instance data is the first 3 rows of the world matrix, same layout as draw indirect instance buffer
+static constexpr uint16_t INSTANCE_STRIDE	= sizeof(float) * 4 * 3;
+static constexpr uint32_t MIN_INSTANCE_NUM	= 2;
+
+static inline void
+fill_instance_data(float *d, const float *m){
+	for (int r=0; r<3; ++r){
+		for (int c=0; c<4; ++c){
+			*d++ = m[c*4+r];
+		}
+	}
+}
+
+// one submit worker per encoder, worker 0 always use the world encoder on the calling thread
+static constexpr uint8_t MAX_SUBMIT_WORKER = 4;
+struct submit_worker {
+	struct ecs_world		w;
+	bgfx_encoder_holder		holder;
+	obj_transforms			transforms;
+	submit_items			items;
+	submit_items			temp;
+	std::vector<uint64_t>	selected;	// bitset of the objects in the sorting queue
+	const char*				err = nullptr;
+
+	void init(struct ecs_world *world, bool main){
+		w = *world;
+		if (!main){
+			w.holder = &holder;
+		}
+		err = nullptr;
+	}
+
+	void apply_material(const struct material_instance *mi){
+		record_error(material_instance_apply(mi, &w));
+	}
+
+	void apply_instanced_material(const struct material_instance *mi){
+		record_error(material_instance_apply_instanced(mi, &w));
+	}
+
+	void record_error(const char* e){
+		if (e && !err){
+			err = e;
+		}
+	}
+
+	void clear(){
+		transforms.clear();
+	}
+};
+
 using group_queues = std::array<matrix_array, MAX_VISIBLE_QUEUE>;
 using group_collection = std::unordered_map<int, group_queues>;
 
-static constexpr uint16_t MAX_SUBMIT_NUM = 4096;
+// linear buffer for submit objects, reset by frame(or by rebuild), grows geometrically and never shrinks
+template<typename T>
+struct frame_arena {
+	static_assert(std::is_trivially_copyable_v<T>, "frame_arena only holds POD");
+	static constexpr uint32_t INIT_CAPACITY = 1024;
+
+	T*			data = nullptr;
+	uint32_t	num = 0;
+	uint32_t	capacity = 0;
+	uint32_t	highwater = 0;
+	uint32_t	grow_count = 0;
+
+	frame_arena() = default;
+	frame_arena(const frame_arena&) = delete;
+	frame_arena& operator=(const frame_arena&) = delete;
+	~frame_arena(){
+		free(data);
+	}
+
+	T& alloc(){
+		if (num == capacity){
+			grow();
+		}
+		T& v = data[num++];
+		if (num > highwater){
+			highwater = num;
+		}
+		return v;
+	}
+
+	T& operator[](uint32_t idx) { assert(idx < num); return data[idx]; }
+	const T& operator[](uint32_t idx) const { assert(idx < num); return data[idx]; }
+
+	uint32_t size() const { return num; }
+
+	void reset(){
+		num = 0;
+	}
+
+private:
+	void grow(){
+		const uint32_t newcap = capacity == 0 ? INIT_CAPACITY : capacity * 2;
+		T* newdata = (T*)realloc(data, sizeof(T) * newcap);
+		if (newdata == nullptr){
+			throw std::bad_alloc();
+		}
+		data = newdata;
+		capacity = newcap;
+		++grow_count;
+	}
+};
+
+struct arena_stat {
+	uint32_t num;
+	uint32_t highwater;
+	uint32_t capacity;
+	uint32_t grow_count;
+
+	template<typename T>
+	void update(const frame_arena<T> &a){
+		num			= a.num;
+		highwater	= a.highwater;
+		capacity	= a.capacity;
+		grow_count	= a.grow_count;
+	}
+};
+
+static inline uint64_t
+now_ns(){
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// counters of one render queue in one frame, only touched by the worker which submits the queue
+struct queue_stat {
+	uint16_t	viewid;
+	uint8_t		queue_index;
+	// filled by sort, kept while replaying
+	uint32_t	visible;
+	uint32_t	culled;
+	uint32_t	material_missing;
+
+	uint32_t	draws;
+	uint32_t	instanced;
+	uint32_t	transforms;
+	uint32_t	cache_hit;
+	uint32_t	cache_miss;
+	uint64_t	submit_ns;
+};
+
+struct sort_stat {
+	uint32_t	visible;
+	uint32_t	culled;
+	uint32_t	material_missing;
+};
+
+// measure the transform cache and the time of one queue submit
+struct queue_stat_scope {
+	queue_stat			&qs;
+	const obj_transforms&trans;
+	const uint32_t		hit, miss, allocated;
+	const uint64_t		begin;
+
+	queue_stat_scope(queue_stat &q, const obj_transforms &t)
+		: qs(q), trans(t), hit(t.hit), miss(t.miss), allocated(t.allocated), begin(now_ns()){}
+
+	~queue_stat_scope(){
+		qs.cache_hit	+= trans.hit - hit;
+		qs.cache_miss	+= trans.miss - miss;
+		qs.transforms	+= trans.allocated - allocated;
+		qs.submit_ns	+= now_ns() - begin;
+	}
+};
+
+struct submit_stat {
+	uint64_t	frame;
+	uint32_t	collected;
+	uint32_t	hitch_collected;
+	uint64_t	collect_ns;
+	bool		replay;
+	uint32_t	cache_capacity;
+	arena_stat	objects;
+	arena_stat	hitchs;
+	uint8_t		queue_count;
+	queue_stat	queues[MAX_VISIBLE_QUEUE];
+};
+
+// written by the world thread once per frame, read by render.stat from any service
+static std::mutex	g_submit_stat_mutex;
+static submit_stat	g_submit_stat;
+// material of an object for one material_index, mi is nullptr if it's missing or its program is invalid
+struct submit_material {
+	const struct material_instance*	mi;
+	bgfx_program_handle_t			prog;
+};
+
 struct submit_context {
 	lua_State *L = nullptr;
 	struct ecs_world* w = nullptr;
@@ -245,15 +552,79 @@ struct submit_context {
 	int Qidx = -1;
 	uint64_t queuemasks[MAX_VISIBLE_QUEUE/64];
 
+	submit_stat stat;
+
+	// materials of every material_index used by the render args, resolved once per object per frame.
+	// they are resolved while collecting on the world thread, the submit workers only read them.
+	uint64_t						material_mask = 0;
+	uint8_t							material_count = 0;
+	frame_arena<submit_material>	materials;
+	std::vector<uint32_t>			material_offset;	// by rm_idx
+	std::vector<uint32_t>			material_frame;		// by rm_idx, the offset is valid if it's the current frame
+	std::vector<uint8_t>			material_invalid;	// by rm_idx, some material is set but its program is invalid
+	uint32_t						frame = 0;
+
+	// return the offset in materials, material_count items for each object
+	uint32_t resolve_materials(uint32_t rmidx){
+		if (rmidx >= material_frame.size()){
+			const size_t n = std::max<size_t>(rmidx + 1, material_frame.size() * 2);
+			material_offset.resize(n);
+			material_frame.resize(n, 0);
+			material_invalid.resize(n, 0);
+		}
+		if (material_frame[rmidx] == frame){
+			return material_offset[rmidx];
+		}
+
+		void* mat[RENDER_MATERIAL_TYPE_MAX];
+		render_material_fetch_compact(w->R, rmidx, material_mask, mat);
+		const uint32_t offset = materials.size();
+		uint8_t invalid = 0;
+		for (uint8_t ii=0; ii<material_count; ++ii){
+			auto mi = (const struct material_instance*)mat[ii];
+			bgfx_program_handle_t prog = BGFX_INVALID_HANDLE;
+			if (mi){
+				prog = material_prog(L, mi);
+				if (!BGFX_HANDLE_IS_VALID(prog)){
+					mi = nullptr;
+					invalid = 1;
+				}
+			}
+			materials.alloc() = submit_material{mi, prog};
+		}
+		material_offset[rmidx] = offset;
+		material_invalid[rmidx] = invalid;
+		material_frame[rmidx] = frame;
+		return offset;
+	}
+
+	const submit_material& material(uint32_t offset, const component::render_args *r) const {
+		const uint64_t lower = material_mask & ((1ull << r->material_index) - 1);
+		return materials[offset + std::popcount(lower)];
+	}
+
 	void init_render_args(){
 		ra_count = 0;
+		material_mask = 0;
 		if (Qidx == -1){
 			Qidx = queue_alloc(w->Q);
 		}
 
 		for (auto& r : ecs::array<component::render_args>(w->ecs)) {
+			queue_stat &qs = stat.queues[ra_count];
+			qs = queue_stat{};
+			qs.viewid		= r.viewid;
+			qs.queue_index	= r.queue_index;
 			ra[ra_count++] = &r;
 			queue_set(w->Q, Qidx, r.queue_index, true);
+			material_mask |= 1ull << r.material_index;
+		}
+		stat.queue_count = ra_count;
+		material_count = (uint8_t)std::popcount(material_mask);
+		materials.reset();
+		if (++frame == 0){
+			std::fill(material_frame.begin(), material_frame.end(), 0);
+			frame = 1;
 		}
 
 		queue_fetch(w->Q, Qidx, queuemasks);
@@ -264,13 +635,21 @@ struct submit_context {
 		w = w_;
 		init_render_args();
 	}
+
+	uint64_t args_signature() const {
+		uint64_t h = ra_count;
+		for (uint8_t ii=0; ii<ra_count; ++ii){
+			const uint64_t v = ((uint64_t)ra[ii]->viewid << 16) | ((uint64_t)ra[ii]->queue_index << 8) | ra[ii]->material_index;
+			h = hash64(h ^ v);
+		}
+		return h;
+	}
 };
 
 struct obj_submiter {
 	struct submit_object {
 		const component::render_object *ro;
-		const struct material_instance* mi;
-		bgfx_program_handle_t prog;
+		uint32_t mat;	// offset in submit_context::materials
 
 		const component::indirect_object *io;
 	#ifdef RENDER_DEBUG
@@ -283,51 +662,193 @@ struct obj_submiter {
 	, component::eid eid
 #endif //RENDER_DEBUG
 	){
-		if (!find_submit_mesh(ro, io))
+		if (!find_submit_mesh(ro, io)){
+			excluded.push_back(excluded_object{ro, io});
 			return ;
+		}
 
-		//TODO
-		// auto mi = find_submit_material(ctx->L, ctx->w, ctx->ra, ro, io);
-		// if (!mi){
-		// 	return ;
-		// }
-
-		assert(num < MAX_SUBMIT_NUM);
-		objects[num++] = submit_object{
-			ro, nullptr, {UINT16_MAX}, io
+		add_queue_index(ro);
+		objects.alloc() = submit_object{
+			ro, ctx->resolve_materials(ro->rm_idx), io
 #ifdef RENDER_DEBUG
 			, eid
 #endif //RENDER_DEBUG
 		};
+		if (ctx->material_invalid[ro->rm_idx]){
+			excluded.push_back(excluded_object{ro, io});
+		}
+	}
+
+	// queue nodes of the objects, so a whole queue can be selected with queue_select
+	void add_queue_index(const component::render_object *ro){
+		visible_idx.push_back(ro->visible_idx);
+		cull_idx.push_back(ro->cull_idx);
+	}
+
+	void sort(const component::render_args *ra, submit_worker &wk){
+		auto &items = queues[ra->queue_index];
+		auto &ss = sorted[ra->queue_index];
+		items.clear();
+		ss = sort_stat{};
+		const uint32_t n = (uint32_t)objects.size();
+		wk.selected.resize((n + 63) / 64);
+		ss.visible = queue_select(ctx->w->Q, visible_idx.data(), cull_idx.data(), n, ra->queue_index, wk.selected.data(), &ss.culled);
+		for (uint32_t is : queue_bits{wk.selected.data(), n}){
+			const submit_object& so = objects[is];
+			const submit_material &sm = ctx->material(so.mat, ra);
+			if (sm.mi && BGFX_HANDLE_IS_VALID(sm.prog)){
+				items.emplace_back(submit_item{submit_sortkey(so.ro, sm.mi, sm.prog), sm.mi, sm.prog, is});
+			} else {
+				++ss.material_missing;
+			}
+		}
+		radix_sort(items, wk.temp);
 	}
 
-	//TODO
-	void sort(){}
+	// every program of the object is valid, material_prog keeps the evicted programs requested
+	bool programs_valid(const component::render_object *ro) const {
+		void* mat[RENDER_MATERIAL_TYPE_MAX];
+		render_material_fetch_compact(ctx->w->R, ro->rm_idx, ctx->material_mask, mat);
+		for (uint8_t ii=0; ii<ctx->material_count; ++ii){
+			auto mi = (const struct material_instance*)mat[ii];
+			if (mi && !BGFX_HANDLE_IS_VALID(material_prog(ctx->L, mi)))
+				return false;
+		}
+		return true;
+	}
 
-	void submit(obj_transforms &trans){
-		
+	// retained draw list is still usable only if every program handle is unchanged and every mesh is still submittable,
+	// and no excluded object could be drawn now
+	bool validate() const {
 		for (uint8_t ii=0; ii<ctx->ra_count; ++ii){
-			auto ra = ctx->ra[ii];
-			for (uint16_t is=0; is<num; ++is){
-				const submit_object& so = objects[is];
-				if (obj_visible(ctx->w->Q, *so.ro, ra->queue_index)){
-					auto mi = find_submit_material(ctx->L, ctx->w, ra, so.ro->rm_idx);
-					if (mi){
-					const auto prog = material_prog(ctx->L, mi);
-						if (BGFX_HANDLE_IS_VALID(prog)){
-							if (so.io){
-								draw_indirect_obj(ctx->L, ctx->w, ra->viewid, so.ro, so.io, mi, ra->material_index, prog, BGFX_DISCARD_ALL, trans);
-							} else {
-								draw_obj(ctx->L, ctx->w, ra->viewid, so.ro, mi, ra->material_index, prog, nullptr, BGFX_DISCARD_ALL, trans);
-							}
-						}
+			for (const auto &si : queues[ctx->ra[ii]->queue_index]){
+				const submit_object& so = objects[si.idx];
+				if (material_prog(ctx->L, si.mi).idx != si.prog.idx || !find_submit_mesh(so.ro, so.io))
+					return false;
+			}
+		}
+		for (const auto &eo : excluded){
+			if (find_submit_mesh(eo.ro, eo.io) && programs_valid(eo.ro))
+				return false;
+		}
+		return true;
+	}
 
-					}
-				}
+	void submit_queue(uint8_t ii, submit_worker &wk){
+		const component::render_args *ra = ctx->ra[ii];
+		queue_stat &qs = ctx->stat.queues[ii];
+		queue_stat_scope scope(qs, wk.transforms);
+		if (!replay){
+			sort(ra, wk);
+		}
+
+		const auto &ss = sorted[ra->queue_index];
+		qs.visible			= ss.visible;
+		qs.culled			= ss.culled;
+		qs.material_missing	= ss.material_missing;
+
+		const auto &items = queues[ra->queue_index];
+		const struct material_instance* applied = nullptr;
+		for (size_t it=0; it<items.size();){
+			++qs.draws;
+			const uint32_t n = draw_instanced(ra, items, it, wk);
+			if (n > 0){
+				qs.instanced += n;
+				applied = nullptr;
+				it += n;
+				continue;
+			}
+
+			const submit_item& si = items[it];
+			const submit_object& so = objects[si.idx];
+			if (submit_reapply(ra, si.mi, applied)){
+				wk.apply_material(si.mi);
+				applied = si.mi;
+			}
+			const uint8_t discardflags = submit_discardflags(ra, items, it);
+			if (so.io){
+				draw_indirect_obj(ctx->L, &wk.w, ra->viewid, so.ro, so.io, si.mi, ra->material_index, si.prog, discardflags, wk.transforms);
+			} else {
+				draw_obj(ctx->L, &wk.w, ra->viewid, so.ro, si.mi, ra->material_index, si.prog, nullptr, discardflags, wk.transforms);
 			}
-			//ctx->w->bgfx->encoder_discard(w->holder->encoder, BGFX_DISCARD_ALL);
+			++it;
+		}
+	}
+
+	bool can_instance(const submit_object &so, struct ecs_world *w) const {
+		return so.io == nullptr && math_size(w->math3d->M, so.ro->worldmat) == 1;
+	}
+
+	// merge the objects which share the same mesh and material with items[from] into one instanced draw call,
+	// return the number of merged objects, 0 means items[from] should be drawn as usual
+	uint32_t draw_instanced(const component::render_args *ra, const submit_items &items, size_t from, submit_worker &wk){
+		struct ecs_world *w = &wk.w;
+		const submit_item &first = items[from];
+		const submit_object &fo = objects[first.idx];
+		if (!can_instance(fo, w))
+			return 0;
+
+		size_t to = from + 1;
+		for (; to < items.size(); ++to){
+			const submit_item &si = items[to];
+			const submit_object &so = objects[si.idx];
+			if (si.prog.idx != first.prog.idx || !material_instance_equal(si.mi, first.mi) || !same_mesh(so.ro, fo.ro) || !can_instance(so, w))
+				break;
+		}
+
+		uint32_t n = (uint32_t)(to - from);
+		if (n < MIN_INSTANCE_NUM)
+			return 0;
+
+		const bgfx_program_handle_t prog = material_instanced_prog(first.mi);
+		if (!BGFX_HANDLE_IS_VALID(prog))
+			return 0;
+
+		n = w->bgfx->get_avail_instance_data_buffer(n, INSTANCE_STRIDE);
+		if (n < MIN_INSTANCE_NUM)
+			return 0;
+
+		bgfx_instance_data_buffer_t idb;
+		w->bgfx->alloc_instance_data_buffer(&idb, n, INSTANCE_STRIDE);
+		float *d = (float*)idb.data;
+		for (uint32_t ii=0; ii<n; ++ii){
+			const submit_object &so = objects[items[from+ii].idx];
+			fill_instance_data(d, math_value(w->math3d->M, so.ro->worldmat));
+			d += INSTANCE_STRIDE / sizeof(float);
 		}
 
+		wk.apply_instanced_material(first.mi);
+		mesh_submit(w, fo.ro, ra->viewid);
+		w->bgfx->encoder_set_instance_data_buffer(w->holder->encoder, &idb, 0, n);
+		w->bgfx->encoder_submit(w->holder->encoder, ra->viewid, prog, fo.ro->render_layer, BGFX_DISCARD_ALL);
+		return n;
+	}
+
+	void submit(submit_worker &wk){
+		for (uint8_t ii=0; ii<ctx->ra_count; ++ii){
+			submit_queue(ii, wk);
+		}
+	}
+
+	// render queues are independent, every worker pick up the next queue and submit it with its own encoder.
+	// bgfx returns NULL when it runs out of encoders, that worker takes no queue and the others (at least worker 0) submit them
+	void submit(job_pool &pool, std::vector<std::unique_ptr<submit_worker>> &workers){
+		std::atomic<uint8_t> next{0};
+		pool.run([&](int widx){
+			submit_worker &wk = *workers[widx];
+			if (widx != 0){
+				wk.holder.encoder = wk.w.bgfx->encoder_begin(true);
+				if (wk.holder.encoder == nullptr)
+					return;
+			}
+			for (uint8_t ii = next++; ii < ctx->ra_count; ii = next++){
+				submit_queue(ii, wk);
+			}
+			if (widx != 0){
+				wk.w.bgfx->encoder_end(wk.holder.encoder);
+				wk.holder.encoder = nullptr;
+			}
+		});
 	}
 
 	void collect(){
@@ -346,23 +867,36 @@ struct obj_submiter {
 	}
 
 	void clear(){
-		ctx = nullptr;
-		num = 0;
+		objects.reset();
+		visible_idx.clear();
+		cull_idx.clear();
+		excluded.clear();
 	}
 
 	submit_context *ctx = nullptr;
-	submit_object objects[MAX_SUBMIT_NUM];
-	uint16_t num = 0;
+	// kept while replaying, so it's reset by rebuild instead of by frame
+	frame_arena<submit_object> objects;
+	std::vector<int> visible_idx;
+	std::vector<int> cull_idx;
+
+	// objects the last collect dropped (mesh not submittable) or added with an invalid program,
+	// they are checked by validate every replayed frame
+	struct excluded_object {
+		const component::render_object *ro;
+		const component::indirect_object *io;
+	};
+	std::vector<excluded_object> excluded;
 
-	//TODO
-	//uint16_t submit_queues[MAX_VISIBLE_QUEUE][MAX_SUBMIT_NUM];
+	// sorted draw list per queue_index, kept until the next rebuild
+	std::array<submit_items, MAX_VISIBLE_QUEUE> queues;
+	std::array<sort_stat, MAX_VISIBLE_QUEUE> sorted;
+	bool replay = false;
 };
 
 struct hitch_submiter {
 	struct submit_hitch{
 		const component::render_object *ro;
-		const struct material_instance* mi;
-		bgfx_program_handle_t prog;
+		uint32_t mat;	// offset in submit_context::materials, only valid with ro
 
 		const group_queues* g;
 		const component::efk_object* eo;
@@ -384,46 +918,57 @@ struct hitch_submiter {
 		}
 
 		assert(ro || eo);
-		//TODO:
-		//auto mi = find_submit_material();
-		assert(num < MAX_SUBMIT_NUM);
-		hitchs[num++] = submit_hitch{
-			ro, nullptr, {UINT16_MAX}, g, eo
+		hitchs.alloc() = submit_hitch{
+			ro, ro ? ctx->resolve_materials(ro->rm_idx) : 0, g, eo
 #ifdef RENDER_DEBUG
 			, eid
 #endif //RENDER_DEBUG
 		};
 	}
 
-	//TODO:
-	void sort(){}
-
-	//
-	void submit(obj_transforms &trans) {
-		for (uint8_t ii=0; ii<ctx->ra_count; ++ii){
-			auto ra = ctx->ra[ii];
-			for (uint16_t ih=0; ih<num; ++ih){
-				const submit_hitch& sh = hitchs[ih];
-				
-				const auto &mats = (*sh.g)[ra->queue_index];
-				if (!mats.empty()){
-					if (sh.ro && queue_check(ctx->w->Q, sh.ro->visible_idx, ra->queue_index)){
-						auto mi = find_submit_material(ctx->L, ctx->w, ra, sh.ro->rm_idx);
-						if (mi){
-							const auto prog = material_prog(ctx->L, mi);
-							if (BGFX_HANDLE_IS_VALID(prog)){
-								draw_obj(ctx->L, ctx->w, ra->viewid, sh.ro, mi, ra->material_index, prog, &mats, BGFX_DISCARD_ALL, trans);
-							}
-						}
+	void sort(const component::render_args *ra, submit_worker &wk){
+		auto &items = wk.items;
+		items.clear();
+		for (uint32_t ih=0; ih<hitchs.size(); ++ih){
+			const submit_hitch& sh = hitchs[ih];
+			const auto &mats = (*sh.g)[ra->queue_index];
+			if (!mats.empty()){
+				if (sh.ro && queue_check(ctx->w->Q, sh.ro->visible_idx, ra->queue_index)){
+					const submit_material &sm = ctx->material(sh.mat, ra);
+					if (sm.mi && BGFX_HANDLE_IS_VALID(sm.prog)){
+						items.emplace_back(submit_item{submit_sortkey(sh.ro, sm.mi, sm.prog), sm.mi, sm.prog, ih});
 					}
+				}
 
-					if (sh.eo && queue_check(ctx->w->Q, sh.eo->visible_idx, ra->queue_index)){
-						submit_efk_obj(ctx->L, ctx->w, sh.eo, mats);
-					}
+				if (sh.eo && queue_check(ctx->w->Q, sh.eo->visible_idx, ra->queue_index)){
+					submit_efk_obj(ctx->L, ctx->w, sh.eo, mats);
 				}
 			}
+		}
+		radix_sort(items, wk.temp);
+	}
 
-			//ctx->w->bgfx->encoder_discard(w->holder->encoder, BGFX_DISCARD_ALL);
+	// hitch objects create math3d temp values and efk_hitch entities, so they are always submitted on the world thread
+	void submit(submit_worker &wk) {
+		for (uint8_t ii=0; ii<ctx->ra_count; ++ii){
+			auto ra = ctx->ra[ii];
+			queue_stat &qs = ctx->stat.queues[ii];
+			queue_stat_scope scope(qs, wk.transforms);
+			sort(ra, wk);
+
+			const auto &items = wk.items;
+			const struct material_instance* applied = nullptr;
+			for (size_t it=0; it<items.size(); ++it){
+				const submit_item& si = items[it];
+				const submit_hitch& sh = hitchs[si.idx];
+				qs.draws += (uint32_t)(*sh.g)[ra->queue_index].size();
+				if (submit_reapply(ra, si.mi, applied)){
+					wk.apply_material(si.mi);
+					applied = si.mi;
+				}
+				const auto &mats = (*sh.g)[ra->queue_index];
+				draw_obj(ctx->L, &wk.w, ra->viewid, sh.ro, si.mi, ra->material_index, si.prog, &mats, submit_discardflags(ra, items, it), wk.transforms);
+			}
 		}
 	}
 
@@ -479,48 +1024,112 @@ struct hitch_submiter {
 	void clear(){
 		clear_groups();
 		ctx = nullptr;
-		num = 0;
+		hitchs.reset();
 	}
 
 	group_collection	groups;
 	submit_context *ctx = nullptr;
-	submit_hitch hitchs[MAX_SUBMIT_NUM];
-	uint16_t num = 0;
-
-	//uint16_t submit_queues[MAX_VISIBLE_QUEUE][MAX_SUBMIT_NUM];
+	frame_arena<submit_hitch> hitchs;
 };
 
 struct submit_cache{
-	obj_transforms	transforms;
-
 	submit_context		ctx;
 	obj_submiter		obj;
 	hitch_submiter		hitch;
 
-#ifdef RENDER_DEBUG
-	struct submit_stat{
-		uint32_t hitch_submit;
-		uint32_t simple_submit;
-		uint32_t efk_hitch_submit;
-		uint32_t hitch_count;
+	std::unique_ptr<job_pool>					pool;
+	std::vector<std::unique_ptr<submit_worker>>	workers;
+
+	submit_cache(){
+		set_workers(1);
+	}
+
+	void set_workers(int n){
+		n = std::clamp(n, 1, (int)MAX_SUBMIT_WORKER);
+		pool.reset(n > 1 ? new job_pool(n) : nullptr);
+		workers.resize(n);
+		for (auto &wk : workers){
+			if (!wk){
+				wk = std::make_unique<submit_worker>();
+			}
+		}
+	}
+
+	submit_worker& main_worker(){
+		return *workers[0];
+	}
+
+	const char* error() const {
+		for (const auto &wk : workers){
+			if (wk->err)
+				return wk->err;
+		}
+		return nullptr;
+	}
+
+	// obj_submiter draw lists are replayed while nothing could change them:
+	// visible/cull masks, render args, render materials, visible entities and scene
+	struct retained_state {
+		uint64_t	queue_version = 0;
+		uint64_t	material_version = 0;
+		uint64_t	args_signature = 0;
+		int			visible_count = -1;
+		bool		dirty = true;
 	};
+	retained_state	retained;
 
-	submit_stat stat;
-#endif //RENDER_DEBUG
+	void invalidate(){
+		retained.dirty = true;
+	}
+
+	bool check_retained(struct ecs_world *w){
+		const retained_state cur = {
+			queue_version(w->Q),
+			render_material_version(w->R),
+			ctx.args_signature(),
+			entity_count(w->ecs, ecs::component_id<component::render_object_visible>),
+			false,
+		};
+		const bool scene_changed = entity_count(w->ecs, ecs::component_id<component::scene_changed>) > 0;
+		const bool same = !retained.dirty && !scene_changed
+			&& cur.queue_version	== retained.queue_version
+			&& cur.material_version	== retained.material_version
+			&& cur.args_signature	== retained.args_signature
+			&& cur.visible_count	== retained.visible_count;
+		retained = cur;
+		return same;
+	}
 
 	void init(lua_State *L, struct ecs_world *w){
 		ctx.init(L, w);
 		obj.ctx = hitch.ctx = &ctx;
+		for (size_t ii=0; ii<workers.size(); ++ii){
+			workers[ii]->init(w, ii == 0);
+		}
 	}
 
 	void clear(){
-		transforms.clear();
-		obj.clear();
+		for (auto &wk : workers){
+			wk->clear();
+		}
 		hitch.clear();
+	}
 
-#ifdef RENDER_DEBUG
-		memset(&stat, 0, sizeof(stat));
-#endif //RENDER_DEBUG
+	void update_stat(){
+		submit_stat &s = ctx.stat;
+		++s.frame;
+		s.replay = obj.replay;
+		s.objects.update(obj.objects);
+		s.hitchs.update(hitch.hitchs);
+		s.collected = obj.objects.size();
+		s.hitch_collected = hitch.hitchs.size();
+		s.cache_capacity = 0;
+		for (const auto &wk : workers){
+			s.cache_capacity += wk->transforms.capacity();
+		}
+
+		std::lock_guard<std::mutex> lock(g_submit_stat_mutex);
+		g_submit_stat = s;
 	}
 };
 
@@ -530,14 +1139,32 @@ struct submit_cache{
 
 static inline void
 render_hitch_submit(lua_State *L, ecs_world* w, submit_cache &cc){
+	const uint64_t begin = now_ns();
 	cc.hitch.collect();
-	cc.hitch.submit(cc.transforms);
+	cc.ctx.stat.collect_ns += now_ns() - begin;
+	cc.hitch.submit(cc.main_worker());
 }
 
 static inline void
 render_submit(lua_State *L, struct ecs_world* w, submit_cache &cc){
-	cc.obj.collect();
-	cc.obj.submit(cc.transforms);
+	const uint64_t begin = now_ns();
+	cc.obj.replay = cc.check_retained(w) && cc.obj.validate();
+	if (!cc.obj.replay){
+		cc.obj.clear();
+		cc.obj.collect();
+	}
+	cc.ctx.stat.collect_ns = now_ns() - begin;
+
+	// every worker may submit every object, in one or more queues
+	for (auto &wk : cc.workers){
+		wk->transforms.reserve(cc.obj.objects.size());
+	}
+
+	if (cc.pool){
+		cc.obj.submit(*cc.pool, cc.workers);
+	} else {
+		cc.obj.submit(cc.main_worker());
+	}
 }
 
 static int
@@ -548,10 +1175,30 @@ lrender_submit(lua_State *L) {
 
 	render_submit(L, w, *w->submit_cache);
 	render_hitch_submit(L, w, *w->submit_cache);
-	
+	w->submit_cache->update_stat();
+
+	const char* err = w->submit_cache->error();
+	if (err){
+		return luaL_error(L, "Apply error : %s", err);
+	}
 	return 0;
 }
 
+static int
+lsubmit_invalidate(lua_State *L) {
+	auto w = getworld(L);
+	w->submit_cache->invalidate();
+	return 0;
+}
+
+static int
+lsubmit_workers(lua_State *L) {
+	auto w = getworld(L);
+	w->submit_cache->set_workers((int)luaL_checkinteger(L, 1));
+	lua_pushinteger(L, (lua_Integer)w->submit_cache->workers.size());
+	return 1;
+}
+
 // static int
 // lrender_preprocess(lua_State *L){
 // 	auto w = getworld(L);
@@ -595,6 +1242,13 @@ lrm_alloc(lua_State *L){
 	return 1;
 }
 
+static int
+lrm_version(lua_State *L){
+	auto w = getworld(L);
+	lua_pushinteger(L, (lua_Integer)render_material_version(w->R));
+	return 1;
+}
+
 static int
 lrm_set(lua_State *L){
 	auto w = getworld(L);
@@ -625,6 +1279,7 @@ luaopen_render_material(lua_State *L) {
 		{ "dealloc",	lrm_dealloc},
 		{ "alloc",		lrm_alloc},
 		{ "set",		lrm_set},
+		{ "version",	lrm_version},
 
 		{ nullptr, 		nullptr },
 	};
@@ -656,23 +1311,64 @@ lexit(lua_State *L){
 	return 0;
 }
 
+static void
+push_arena_stat(lua_State *L, const arena_stat &s, const char* name){
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, s.num);
+	lua_setfield(L, -2, "num");
+	lua_pushinteger(L, s.highwater);
+	lua_setfield(L, -2, "highwater");
+	lua_pushinteger(L, s.capacity);
+	lua_setfield(L, -2, "capacity");
+	lua_pushinteger(L, s.grow_count);
+	lua_setfield(L, -2, "grow");
+	lua_setfield(L, -2, name);
+}
+
+#define PUSH_STAT(_S, _NAME)	lua_pushinteger(L, (lua_Integer)(_S)._NAME); lua_setfield(L, -2, #_NAME)
+
+static void
+push_queue_stat(lua_State *L, const queue_stat &qs){
+	lua_createtable(L, 0, 11);
+	PUSH_STAT(qs, viewid);
+	PUSH_STAT(qs, queue_index);
+	PUSH_STAT(qs, visible);
+	PUSH_STAT(qs, culled);
+	PUSH_STAT(qs, material_missing);
+	PUSH_STAT(qs, draws);
+	PUSH_STAT(qs, instanced);
+	PUSH_STAT(qs, transforms);
+	PUSH_STAT(qs, cache_hit);
+	PUSH_STAT(qs, cache_miss);
+	PUSH_STAT(qs, submit_ns);
+}
+
+// {frame, replay, collected, hitch_collected, collect_ns, cache_capacity, objects = arena, hitchs = arena, queues = {queue_stat, ...}}
 static int
 lsubmit_stat(lua_State *L){
-	lua_createtable(L, 0, 4);
-//TODO
-//#ifdef RENDER_DEBUG
-//	lua_pushinteger(L, cc.stat.hitch_submit);
-//	lua_setfield(L, -2, "hitch_submit");
-//
-//	lua_pushinteger(L, cc.stat.simple_submit);
-//	lua_setfield(L, -2, "simple_submit");
-//
-//	lua_pushinteger(L, cc.stat.efk_hitch_submit);
-//	lua_setfield(L, -2, "efk_hitch_submit");
-//
-//	lua_pushinteger(L, cc.stat.hitch_count);
-//	lua_setfield(L, -2, "hitch_count");
-//#endif //RENDER_DEBUG
+	submit_stat s;
+	{
+		std::lock_guard<std::mutex> lock(g_submit_stat_mutex);
+		s = g_submit_stat;
+	}
+
+	lua_createtable(L, 0, 8);
+	PUSH_STAT(s, frame);
+	PUSH_STAT(s, collected);
+	PUSH_STAT(s, hitch_collected);
+	PUSH_STAT(s, collect_ns);
+	PUSH_STAT(s, cache_capacity);
+	lua_pushboolean(L, s.replay);
+	lua_setfield(L, -2, "replay");
+	push_arena_stat(L, s.objects, "objects");
+	push_arena_stat(L, s.hitchs, "hitchs");
+
+	lua_createtable(L, s.queue_count, 0);
+	for (uint8_t ii=0; ii<s.queue_count; ++ii){
+		push_queue_stat(L, s.queues[ii]);
+		lua_seti(L, -2, ii+1);
+	}
+	lua_setfield(L, -2, "queues");
 	return 1;
 }
 
@@ -696,6 +1392,8 @@ luaopen_system_render(lua_State *L){
 		{ "exit",				lexit},
 		//{ "render_preprocess",	lrender_preprocess},
 		{ "render_submit", 		lrender_submit},
+		{ "submit_workers",		lsubmit_workers},
+		{ "submit_invalidate",	lsubmit_invalidate},
 		//{ "render_hitch_submit",lrender_hitch_submit},
 		//{ "render_postprocess", lrender_postprocess},
 		{ nullptr, 				nullptr },
@@ -123,7 +123,7 @@ intcoord(struct screen *S, const float rect[4], struct grid_rect *r) {
 	r->x2 = ceilf(x2 * TILE_LENGTH);
 	if (r->x2 >= TILE_LENGTH)
 		r->x2 = TILE_LENGTH - 1;
-	r->y2 = ceilf(x2 * TILE_LENGTH);
+	r->y2 = ceilf(y2 * TILE_LENGTH);
 	if (r->y2 >= TILE_LENGTH)
 		r->y2 = TILE_LENGTH - 1;
 	return 0;
@@ -2,6 +2,8 @@ local ecs   = ...
 local world = ecs.world
 local w     = world.w
 
+local RS    = world:clibs "system.render"
+
 local MAX_LAYER<const> = 64
 
 local layer_names = {
@@ -77,6 +79,7 @@ function irl.set_layer(e, layername)
     e.render_layer = layername
     e.render_object.render_layer = lidx
     w:submit(e)
+    RS.submit_invalidate()
 end
 
 function irl.is_opacity_layer(layername)
@@ -92,6 +95,7 @@ function rl_sys:start_frame()
         end
 
         opacity_layers = build_opacity_layers()
+        RS.submit_invalidate()
         break
     end
 end
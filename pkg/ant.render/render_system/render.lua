@@ -17,6 +17,7 @@ local sampler		= import_package "ant.render.core".sampler
 local iviewport		= ecs.require "ant.render|viewport.state"
 
 local ig 			= ecs.require "ant.group|group"
+local RS			= world:clibs "system.render"
 
 local LAYER_NAMES<const> = {"foreground", "opacity", "background", "translucent", "decal_stage", "ui_stage"}
 
@@ -339,6 +340,7 @@ end
 
 function irender.mark_group_visible(gid, enable)
 	ig.filter_group_tag(gid, enable, "render_object_visible", "view_visible", "render_object")
+	RS.submit_invalidate()
 end
 
 return irender
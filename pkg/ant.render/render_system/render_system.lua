@@ -5,6 +5,7 @@ local w = world.w
 local assetmgr  = import_package "ant.asset"
 local setting		= import_package "ant.settings"
 local ENABLE_PRE_DEPTH<const>	= not setting:get "graphic/disable_pre_z"
+local SUBMIT_WORKERS<const>		= setting:get "graphic/render/submit_workers" or 1
 
 local L			= import_package "ant.render.core".layout
 
@@ -26,6 +27,7 @@ local RM        = ecs.require "ant.material|material"
 
 local render_sys= ecs.system "render_system"
 local R			= world:clibs "render.render_material"
+local RS		= world:clibs "system.render"
 
 function render_sys:device_check()
 	local caps = bgfx.get_caps()
@@ -127,6 +129,7 @@ end
 
 function render_sys:init()
 	assert(imaterial.default_material_index() == queuemgr.default_material_index())
+	RS.submit_workers(SUBMIT_WORKERS)
 end
 
 local function create_material_instance(e)
@@ -247,6 +250,8 @@ end
 
 function render_sys:entity_init()
 	for e in w:select "INIT render_object:update" do
+		RS.submit_invalidate()
+
 		--mesh & material
 		w:extend(e, "mesh_result:in material:in")
 		update_ro(e.render_object, e.mesh_result)
@@ -319,7 +324,10 @@ local function add_render_arg(qe)
 	local viewid = rt.viewid
 
 	bgfx.touch(viewid)
-	qe.render_args = RENDER_ARGS[qe.queue_name]
+	local ra = RENDER_ARGS[qe.queue_name]
+	-- only a sequential view draws in submit order, see submit_queue in render.cpp
+	ra.sequential = rt.view_mode == "s" and 1 or 0
+	qe.render_args = ra
 end
 
 function render_sys:commit_system_properties()
@@ -374,6 +382,7 @@ function render_sys:entity_remove()
 	end
 
 	for e in w:select "REMOVED render_object:update filter_material:in" do
+		RS.submit_invalidate()
 		clear_filter_material(e.filter_material)
 
 		clear_render_object(e.render_object)
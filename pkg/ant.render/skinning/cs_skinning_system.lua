@@ -183,7 +183,7 @@ function cs_skinning_sys:skin_mesh()
 
 	local meshskin
 	local worldmat
-	for e in w:select "skinning scene?in meshskin?in render_object?update bounding?update skininfo?update" do
+	for e in w:select "skinning scene?in meshskin?in render_object?update bounding?update skininfo?update bounding_changed?out" do
 		if e.meshskin then
 			meshskin = e.meshskin
 			worldmat = e.scene.worldmat
@@ -199,6 +199,7 @@ function cs_skinning_sys:skin_mesh()
 			if mc.NULL ~= e.bounding.aabb then
 				math3d.unmark(e.bounding.scene_aabb)
 				e.bounding.scene_aabb = math3d.mark(math3d.aabb_transform(worldmat, e.bounding.aabb))
+				e.bounding_changed = true
 			end
 		end
 	end
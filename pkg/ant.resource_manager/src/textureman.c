@@ -4,15 +4,81 @@
 #include <lauxlib.h>
 #include <stdint.h>
 #include "luabgfx.h"
+#include "simplelock.h"
 #include "textureman.h"
 
 #define TEXTURE_MAX_ID 0x7fff
+#define LRU_NIL 0xffff
+// a texture loaded again within these frames after its eviction is counted as thrash
+#define TEXTURE_THRASH_FRAMES (30 * 10)
 
 static uint16_t g_texture[TEXTURE_MAX_ID];
 static uint16_t g_texture_id = 0;
 static uint32_t g_frame = 0;
 static uint32_t g_texture_timestamp[TEXTURE_MAX_ID];
 
+// Only the textures with a gpu size are in the lru list, the head is the most recently used one.
+// texture_get may be called from other threads, so the list is guarded by a spinlock.
+struct lru_node {
+	uint16_t prev;
+	uint16_t next;
+};
+
+static struct {
+	spinlock_t lock;
+	uint16_t head;
+	uint16_t tail;
+	uint32_t loaded;
+	uint32_t evicted;
+	uint32_t thrash;
+	uint64_t resident;
+} g_lru = { 0, LRU_NIL, LRU_NIL, 0, 0, 0, 0 };
+
+static struct lru_node g_lru_node[TEXTURE_MAX_ID];
+static uint32_t g_texture_size[TEXTURE_MAX_ID];
+// frame + 1 of the last eviction, 0 for never
+static uint32_t g_texture_evicted[TEXTURE_MAX_ID];
+
+static inline void
+lru_unlink(int index) {
+	struct lru_node *n = &g_lru_node[index];
+	if (n->prev == LRU_NIL)
+		g_lru.head = n->next;
+	else
+		g_lru_node[n->prev].next = n->next;
+	if (n->next == LRU_NIL)
+		g_lru.tail = n->prev;
+	else
+		g_lru_node[n->next].prev = n->prev;
+}
+
+static inline void
+lru_push(int index) {
+	struct lru_node *n = &g_lru_node[index];
+	n->prev = LRU_NIL;
+	n->next = g_lru.head;
+	if (g_lru.head == LRU_NIL)
+		g_lru.tail = (uint16_t)index;
+	else
+		g_lru_node[g_lru.head].prev = (uint16_t)index;
+	g_lru.head = (uint16_t)index;
+}
+
+static inline void
+texture_touch(int index) {
+	if (g_texture_timestamp[index] == g_frame)
+		return;
+	g_texture_timestamp[index] = g_frame;
+	if (g_texture_size[index] == 0)
+		return;
+	spin_lock(&g_lru);
+	if (g_texture_size[index] != 0 && g_lru.head != index) {
+		lru_unlink(index);
+		lru_push(index);
+	}
+	spin_unlock(&g_lru);
+}
+
 static int
 ltexture_create(lua_State *L) {
 	uint16_t handle = BGFX_LUAHANDLE_ID(TEXTURE, (int)luaL_checkinteger(L, 1));
@@ -38,7 +104,7 @@ static int
 ltexture_get(lua_State *L) {
 	int id = checktextureid(L, 1);
 	uint16_t h = g_texture[id - 1];
-	g_texture_timestamp[id - 1] = g_frame;
+	texture_touch(id - 1);
 	int luahandle = (BGFX_HANDLE_TEXTURE << 16) | h;
 	lua_pushinteger(L, luahandle);
 	return 1;
@@ -50,7 +116,7 @@ texture_transform(int id) {
 	if (id <= 0 || id > g_texture_id)
 		return handle.idx;
 	uint16_t h = g_texture[id - 1];
-	g_texture_timestamp[id - 1] = g_frame;
+	texture_touch(id - 1);
 	return h;
 }
 
@@ -68,6 +134,51 @@ ltexture_set(lua_State *L) {
 	return 0;
 }
 
+// set the gpu size of the texture, 0 for unloaded
+static int
+ltexture_size(lua_State *L) {
+	int id = checktextureid(L, 1);
+	lua_Integer bytes = luaL_checkinteger(L, 2);
+	if (bytes < 0 || bytes > UINT32_MAX)
+		return luaL_error(L, "Invalid texture size %d", (int)bytes);
+	int index = id - 1;
+	spin_lock(&g_lru);
+	uint32_t old = g_texture_size[index];
+	if (old == 0 && bytes > 0) {
+		lru_push(index);
+		++g_lru.loaded;
+		uint32_t evicted = g_texture_evicted[index];
+		if (evicted != 0 && g_frame - (evicted - 1) < TEXTURE_THRASH_FRAMES)
+			++g_lru.thrash;
+	} else if (old > 0 && bytes == 0) {
+		lru_unlink(index);
+		--g_lru.loaded;
+		// only a destroyed texture is evicted, a downgraded one is still loaded
+		g_texture_evicted[index] = g_frame + 1;
+		++g_lru.evicted;
+	}
+	g_texture_size[index] = (uint32_t)bytes;
+	g_lru.resident = g_lru.resident - old + (uint32_t)bytes;
+	spin_unlock(&g_lru);
+	return 0;
+}
+
+// return resident bytes, loaded count, evicted count, thrash count
+static int
+ltexture_stats(lua_State *L) {
+	spin_lock(&g_lru);
+	lua_Integer resident = (lua_Integer)g_lru.resident;
+	lua_Integer loaded = g_lru.loaded;
+	lua_Integer evicted = g_lru.evicted;
+	lua_Integer thrash = g_lru.thrash;
+	spin_unlock(&g_lru);
+	lua_pushinteger(L, resident);
+	lua_pushinteger(L, loaded);
+	lua_pushinteger(L, evicted);
+	lua_pushinteger(L, thrash);
+	return 4;
+}
+
 static int
 lframe_tick(lua_State *L) {
 	int f = g_frame++;
@@ -177,6 +288,42 @@ lframe_old(lua_State *L) {
 	return 1;
 }
 
+// return the least recently used textures to evict until the resident bytes is not larger than limit,
+// the ones used in the last `idle` frames are kept. Nothing is changed here, the caller reports the new
+// size by texture_size after it actually destroys or downgrades the texture.
+static int
+lframe_evict(lua_State *L) {
+	lua_Integer limit = luaL_checkinteger(L, 1);
+	int idle = (int)luaL_checkinteger(L, 2);
+	if (limit < 0)
+		return luaL_error(L, "Invalid limit %d", (int)limit);
+	check_result(L, 3);
+	uint16_t ids[256];
+	int n = 0;
+	spin_lock(&g_lru);
+	uint64_t resident = g_lru.resident;
+	int index = g_lru.tail;
+	while (n < (int)(sizeof(ids)/sizeof(ids[0])) && resident > (uint64_t)limit && index != LRU_NIL) {
+		if ((int)read_timestamp(index) < idle)
+			break;
+		resident -= g_texture_size[index];
+		ids[n++] = (uint16_t)index;
+		index = g_lru_node[index].prev;
+	}
+	spin_unlock(&g_lru);
+	int i;
+	for (i=0;i<n;i++) {
+		lua_pushinteger(L, ids[i]+1);
+		lua_rawseti(L, 3, i+1);
+	}
+	int on = (int)lua_rawlen(L, 3);
+	for (i=n+1;i<=on;i++) {
+		lua_pushnil(L);
+		lua_rawseti(L, 3, i);
+	}
+	return 1;
+}
+
 LUAMOD_API int
 luaopen_textureman_client(lua_State *L) {
 	luaL_checkversion(L);
@@ -197,9 +344,12 @@ luaopen_textureman_server(lua_State *L) {
 		{ "texture_create", ltexture_create },
 		{ "texture_set", ltexture_set },
 		{ "texture_timestamp", ltexture_timestamp },
+		{ "texture_size", ltexture_size },
+		{ "texture_stats", ltexture_stats },
 		{ "frame_tick", lframe_tick },
 		{ "frame_new", lframe_new },
 		{ "frame_old", lframe_old },
+		{ "frame_evict", lframe_evict },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L, l);	
@@ -1,6 +1,10 @@
+local ltask = require "ltask"
 local bgfx = require "bgfx"
 local serialize = import_package "ant.serialize"
 local aio = import_package "ant.io"
+local setting = import_package "ant.settings"
+
+local PREWARM_BUDGET <const> = (setting:get "graphic/material/prewarm_budget" or 2) / 1000
 
 local PM = require "programan.server"
 PM.program_init{
@@ -244,8 +248,7 @@ local function material_create(filename)
     return material, fxcfg, attribute
 end
 
-function S.material_create(filename)
-    local material, fxcfg, attribute = material_create(filename)
+local function material_register(filename, material, fxcfg, attribute)
     local pid = material.fx.prog
     if pid then
         MATERIALS[pid] = {
@@ -278,10 +281,124 @@ function S.material_create(filename)
             type     = "draw_indirect"
         }
     end
+end
 
+-- materials created ahead by S.material_prewarm, they are already registered
+local PREWARMED = {}
+-- filename -> token of the material being created by the prewarm task
+local PREWARMING = {}
+local PREWARM_QUEUE = {}
+local PrewarmHead = 1
+local PrewarmTail = 0
+-- filename -> true for the materials returned by S.material_create and not destroyed
+local LOADED = {}
+-- filenames of the materials created since S.material_record_begin
+local RECORD
+
+function S.material_create(filename)
+    if RECORD then
+        RECORD[filename] = true
+    end
+    LOADED[filename] = true
+    local token = PREWARMING[filename]
+    if token then
+        ltask.wait(token)
+    end
+    local p = PREWARMED[filename]
+    if p then
+        PREWARMED[filename] = nil
+        return p.material, p.attribute
+    end
+    local material, fxcfg, attribute = material_create(filename)
+    material_register(filename, material, fxcfg, attribute)
     return material, attribute
 end
 
+function S.material_record_begin()
+    RECORD = {}
+end
+
+-- return the sorted filenames of the recorded materials, and save them to a local file (one filename per line) if path is given
+function S.material_record_end(path)
+    local list = {}
+    for filename in pairs(assert(RECORD, "material record is not begun")) do
+        list[#list+1] = filename
+    end
+    RECORD = nil
+    table.sort(list)
+    if path then
+        local f <close> = assert(io.open(path, "wb"))
+        f:write(table.concat(list, "\n"))
+    end
+    return list
+end
+
+local prewarmToken = {}
+
+-- create the materials of a record (a list of filenames, or the vfs path of a saved record) in the background,
+-- graphic/material/prewarm_budget milliseconds per frame, so they are ready before the level uses them
+function S.material_prewarm(record)
+    if type(record) == "string" then
+        local list = {}
+        for filename in aio.readall(record):gmatch "[^\r\n]+" do
+            list[#list+1] = filename
+        end
+        record = list
+    end
+    local empty = PrewarmHead > PrewarmTail
+    for _, filename in ipairs(record) do
+        PrewarmTail = PrewarmTail + 1
+        PREWARM_QUEUE[PrewarmTail] = filename
+    end
+    if empty and PrewarmHead <= PrewarmTail then
+        ltask.wakeup(prewarmToken)
+    end
+end
+
+function S.material_prewarm_pending()
+    return PrewarmTail - PrewarmHead + 1
+end
+
+-- runs in its own task, the frame loop of the resource service never waits for it
+ltask.fork(function ()
+    while true do
+        ltask.wait(prewarmToken)
+        local used = 0
+        while PrewarmHead <= PrewarmTail do
+            local filename = PREWARM_QUEUE[PrewarmHead]
+            PREWARM_QUEUE[PrewarmHead] = nil
+            PrewarmHead = PrewarmHead + 1
+            if not PREWARMED[filename] and not LOADED[filename] then
+                -- material_create yields on io, S.material_create waits for it meanwhile
+                local token = {}
+                local start = ltask.counter()
+                PREWARMING[filename] = token
+                local ok, material, fxcfg, attribute = pcall(material_create, filename)
+                PREWARMING[filename] = nil
+                if ok then
+                    material_register(filename, material, fxcfg, attribute)
+                    PREWARMED[filename] = {
+                        material = material,
+                        attribute = attribute,
+                    }
+                else
+                    log.warn(("Prewarm material failed, file:%s, %s"):format(filename, material))
+                end
+                ltask.multi_wakeup(token)
+                used = used + ltask.counter() - start
+            end
+            if used >= PREWARM_BUDGET then
+                -- the budget of this frame is used up
+                ltask.sleep(1)
+                used = 0
+            else
+                ltask.sleep(0)
+            end
+        end
+        PrewarmHead, PrewarmTail = 1, 0
+    end
+end)
+
 function S.material_mark(pid)
     MATERIAL_MARKED[pid] = true
 end
@@ -309,7 +426,7 @@ end
 --the serive call will fully remove this material, both cpu and gpu side
 function S.material_destroy(material)
     local pid = material.fx.prog
-    assert(MATERIALS[pid])
+    LOADED[assert(MATERIALS[pid]).filename] = nil
     MATERIALS[pid] = nil
     material_destroy(material.fx)
 
@@ -4,6 +4,11 @@ local datalist   = require "datalist"
 local textureman = require "textureman.server"
 local image      = require "image"
 local aio        = import_package "ant.io"
+local setting    = import_package "ant.settings"
+
+local TEXTURE_BUDGET <const> = (setting:get "graphic/texture/budget" or 256) * 1024 * 1024
+local STREAM_ENABLE <const> = setting:get "graphic/texture/stream/enable"
+local STREAM_BASE_SIZE <const> = setting:get "graphic/texture/stream/base_size" or 64
 
 local ext_service = {}
 
@@ -188,6 +193,63 @@ local function which_texture_type(info)
     return info.numLayers > 1 and "SAMPLER2DARRAY" or "SAMPLER2D"
 end
 
+-- GPU bytes of the loaded textures are tracked by textureman, streamed textures only count their resident mips
+local function setResident(c, bytes)
+    textureman.texture_size(c.id, bytes)
+end
+
+-- Streamed textures are plain 2d textures with a full mip chain.
+-- Only the mips from `lod` are resident: the gpu texture is (width >> lod, height >> lod).
+local function streamBytes(s, lod)
+    local n = 0
+    for i = lod + 1, #s.sizes do
+        n = n + s.sizes[i]
+    end
+    return n
+end
+
+local function createStreamHandle(c, s, mips, lod)
+    local w, h = math.max(1, s.width >> lod), math.max(1, s.height >> lod)
+    local handle = bgfx.create_texture2d(w, h, true, 1, s.format, c.flag)
+    for m = lod, #mips - 1 do
+        local mw, mh = math.max(1, s.width >> m), math.max(1, s.height >> m)
+        bgfx.update_texture2d(handle, 0, m - lod, 0, 0, mw, mh, bgfx.memory_buffer(mips[m+1]))
+    end
+    bgfx.set_name(handle, c.name)
+    return handle
+end
+
+local function createStreamTexture(c, textureData)
+    local ti = textureData.info
+    if textureData.value or ti.cubeMap or ti.depth > 1 or ti.numLayers > 1 or ti.numMips <= 1 then
+        return
+    end
+    local info, mips = image.mipmaps(aio.readall(c.name.."|main.bin"))
+    if #mips ~= info.numMips then
+        return
+    end
+    local sizes = {}
+    local base = #mips - 1
+    for i = 1, #mips do
+        sizes[i] = #mips[i]
+        if base == #mips - 1 and math.max(info.width >> (i-1), info.height >> (i-1)) <= STREAM_BASE_SIZE then
+            base = i - 1
+        end
+    end
+    local s = {
+        width = info.width,
+        height = info.height,
+        format = info.format,
+        sizes = sizes,
+        base = base,
+        lod = base,
+    }
+    c.flag = textureData.flag
+    c.stream = s
+    setResident(c, streamBytes(s, base))
+    return createStreamHandle(c, s, mips, base)
+end
+
 local function asyncCreateTexture(name, textureData)
     if createQueue[name] then
         return
@@ -232,6 +294,8 @@ local function asyncDestroyTexture(c)
 	end
     textureman.texture_set(c.id, DefaultTexture[c.type])
     c.handle = nil
+    c.stream = nil
+    setResident(c, 0)
 end
 
 local S = require "thread.main"
@@ -256,7 +320,10 @@ ltask.fork(function ()
             local textureData = createQueue[name]
             createQueue[name] = nil
             local c = textureByName[name]
-            local handle = textureData.handle or createTexture(textureData)
+            local handle = textureData.handle or (STREAM_ENABLE and createStreamTexture(c, textureData)) or createTexture(textureData)
+            if not c.stream then
+                setResident(c, textureData.info and textureData.info.storageSize or 0)
+            end
             c.handle = handle
             c.flag   = textureData.flag
             textureman.texture_set(c.id, handle)
@@ -280,12 +347,97 @@ local function blockWaitTexture(name)
 	return token
 end
 
+local streamQueue = {}
+local streamToken = {}
+
+local function asyncStreamTexture(c, lod)
+    if streamQueue[c.name] then
+        return
+    end
+    streamQueue[c.name] = lod
+    streamQueue[#streamQueue+1] = c.name
+    if #streamQueue == 1 then
+        ltask.wakeup(streamToken)
+    end
+end
+
+-- a finer (or coarser) copy of the texture is built mip by mip, then swapped in
+ltask.fork(function ()
+    while true do
+        ltask.wait(streamToken)
+        while true do
+            local name = table.remove(streamQueue, 1)
+            if not name then
+                break
+            end
+            local lod = streamQueue[name]
+            streamQueue[name] = nil
+            local c = textureByName[name]
+            local s = c and c.stream
+            if s and s.lod ~= lod then
+                local old = c.handle
+                local _, mips = image.mipmaps(aio.readall(name.."|main.bin"))
+                while FrameLoaded > MaxFrameLoaded do
+                    ltask.sleep(10)
+                end
+                local handle = createStreamHandle(c, s, mips, lod)
+                FrameLoaded = FrameLoaded + 1
+                if c.stream == s and c.handle == old then
+                    destroyQueue[#destroyQueue+1] = old
+                    c.handle = handle
+                    s.lod = lod
+                    setResident(c, streamBytes(s, lod))
+                    textureman.texture_set(c.id, handle)
+                else
+                    -- destroyed or reloaded while streaming
+                    destroyQueue[#destroyQueue+1] = handle
+                end
+                ltask.sleep(0)
+            end
+        end
+    end
+end)
+
+-- Recently used textures are streamed one mip finer per step while the budget allows
+local function updateStream(interval)
+    local ids = {}
+    for id, c in pairs(textureById) do
+        if c.stream and c.handle then
+            ids[#ids+1] = id
+        end
+    end
+    if #ids == 0 then
+        return
+    end
+    local idle = textureman.texture_timestamp(ids)
+    local list = {}
+    for i = 1, #ids do
+        list[i] = { c = textureById[ids[i]], idle = idle[i] }
+    end
+    table.sort(list, function (a, b) return a.idle > b.idle end)
+
+    local bytes = textureman.texture_stats()
+    for i = #list, 1, -1 do
+        local item = list[i]
+        if item.idle > interval then
+            break
+        end
+        local s = item.c.stream
+        if s.lod > 0 then
+            local delta = streamBytes(s, s.lod - 1) - streamBytes(s, s.lod)
+            if bytes + delta <= TEXTURE_BUDGET then
+                asyncStreamTexture(item.c, s.lod - 1)
+                bytes = bytes + delta
+            end
+        end
+    end
+end
+
 local update; do
     local FrameNew = 0
     local FrameCur = 1
     local results = {}
     local UpdateNewInterval <const> = 30 *  1 --  1s
-    local UpdateOldInterval <const> = 30 * 60 -- 60s
     local InvalidTexture <const> = ("HHH"):pack(DefaultTexture.SAMPLER2D & 0xffff, DefaultTexture.SAMPLERCUBE & 0xffff, DefaultTexture.SAMPLER2DARRAY & 0xffff)
     function update()
         for i = 1, #destroyQueue do
@@ -313,17 +465,25 @@ local update; do
                 end
                 FrameNew = FrameCur - 1
             end
-        end
-        if FrameCur % UpdateOldInterval == 0 then
-            textureman.frame_old(UpdateOldInterval, InvalidTexture, results)
+            -- streamed textures drop their fine mips first, the others are destroyed,
+            -- textureman only learns the new size from setResident when that really happens
+            textureman.frame_evict(TEXTURE_BUDGET, UpdateNewInterval, results)
             for i = 1, #results do
                 local id = results[i]
                 local c = textureById[id]
                 if c and (not rt_table[id]) and (not chain_table[id]) then
-                    asyncDestroyTexture(c)
-                    print("Destroy Texture: " .. c.name)
+                    local s = c.stream
+                    if s and s.lod < s.base then
+                        asyncStreamTexture(c, s.base)
+                    else
+                        asyncDestroyTexture(c)
+                        print("Destroy Texture: " .. c.name)
+                    end
                 end
             end
+            if STREAM_ENABLE and #streamQueue == 0 then
+                updateStream(UpdateNewInterval)
+            end
         end
         FrameCur = FrameCur + 1
         FrameLoaded = 0
@@ -475,6 +635,16 @@ function S.texture_content(id)
 	return textureById[id]
 end
 
+function S.texture_stats()
+	local resident, loaded, evicted, thrash = textureman.texture_stats()
+	return {
+		resident = resident,
+		loaded = loaded,
+		evicted = evicted,
+		thrash = thrash,
+	}
+end
+
 return {
     update = update
 }
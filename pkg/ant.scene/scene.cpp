@@ -2,9 +2,24 @@
 #include "ecs/select.h"
 #include "ecs/component.hpp"
 #include "flatmap.h"
+#include "jobpool.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define SCENE_SIMD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define SCENE_SIMD_NEON
+#endif
 
 extern "C" {
 	#include "math3d.h"
@@ -29,41 +44,485 @@ math3d_update(struct math_context* math3d, math_t& id, math_t const& m) {
 	id = math_mark(math3d, m);
 }
 
-static bool
-worldmat_update(flatmap<component::eid, math_t>& worldmats, struct math_context* math3d, component::scene& s, component::eid& id, struct ecs_world *w) {
-	math_t mat = math3d_make_srt(math3d, s.s, s.r, s.t);
-	if (!math_isnull(s.mat)) {
-		mat = math3d_mul_matrix(math3d, mat, s.mat);
-	}
-	if (s.parent != 0) {
-		auto parentmat = worldmats.find(s.parent);
-		if (!parentmat) {
-			if (w) {
-				if ((component::eid)s.parent >= id)
-					return false;
-				auto e = ecs::find_entity(w->ecs, (component::eid)s.parent);
-				if (e.invalid()) {
-					return false;
-				}
-				component::scene *ps = e.component<component::scene>();
-				if (ps == nullptr) {
-					return false;
-				}
-				parentmat = &ps->worldmat;
-				worldmats.insert_or_assign(s.parent, ps->worldmat);
-			} else {
-				return false;
+// column major, the same layout as math3d
+struct alignas(16) scene_mat {
+	float v[16];
+};
+
+static inline void
+mat_identity(scene_mat &m) {
+	memset(m.v, 0, sizeof(m.v));
+	m.v[0] = m.v[5] = m.v[10] = m.v[15] = 1.f;
+}
+
+// r = a * b, r must not be a or b
+static inline void
+mat_mul(const scene_mat &a, const scene_mat &b, scene_mat &r) {
+#if defined(SCENE_SIMD_SSE)
+	const __m128 a0 = _mm_load_ps(a.v), a1 = _mm_load_ps(a.v+4), a2 = _mm_load_ps(a.v+8), a3 = _mm_load_ps(a.v+12);
+	for (int ii=0; ii<4; ++ii) {
+		const float *c = b.v + ii*4;
+		__m128 x = _mm_mul_ps(a0, _mm_set1_ps(c[0]));
+		x = _mm_add_ps(x, _mm_mul_ps(a1, _mm_set1_ps(c[1])));
+		x = _mm_add_ps(x, _mm_mul_ps(a2, _mm_set1_ps(c[2])));
+		x = _mm_add_ps(x, _mm_mul_ps(a3, _mm_set1_ps(c[3])));
+		_mm_store_ps(r.v + ii*4, x);
+	}
+#elif defined(SCENE_SIMD_NEON)
+	const float32x4_t a0 = vld1q_f32(a.v), a1 = vld1q_f32(a.v+4), a2 = vld1q_f32(a.v+8), a3 = vld1q_f32(a.v+12);
+	for (int ii=0; ii<4; ++ii) {
+		const float *c = b.v + ii*4;
+		float32x4_t x = vmulq_n_f32(a0, c[0]);
+		x = vmlaq_n_f32(x, a1, c[1]);
+		x = vmlaq_n_f32(x, a2, c[2]);
+		x = vmlaq_n_f32(x, a3, c[3]);
+		vst1q_f32(r.v + ii*4, x);
+	}
+#else
+	for (int ii=0; ii<4; ++ii) {
+		const float *c = b.v + ii*4;
+		for (int jj=0; jj<4; ++jj) {
+			r.v[ii*4+jj] = a.v[jj] * c[0] + a.v[4+jj] * c[1] + a.v[8+jj] * c[2] + a.v[12+jj] * c[3];
+		}
+	}
+#endif
+}
+
+// T * R * S, the same as math3d_make_srt
+static inline void
+mat_srt(const float *s, const float *q, const float *t, scene_mat &m) {
+	const float x2 = q[0] + q[0], y2 = q[1] + q[1], z2 = q[2] + q[2];
+	const float xx = q[0] * x2, yy = q[1] * y2, zz = q[2] * z2;
+	const float xy = q[0] * y2, xz = q[0] * z2, yz = q[1] * z2;
+	const float wx = q[3] * x2, wy = q[3] * y2, wz = q[3] * z2;
+	float *v = m.v;
+	v[0]  = (1.f - (yy + zz)) * s[0];	v[1]  = (xy + wz) * s[0];			v[2]  = (xz - wy) * s[0];			v[3]  = 0.f;
+	v[4]  = (xy - wz) * s[1];			v[5]  = (1.f - (xx + zz)) * s[1];	v[6]  = (yz + wx) * s[1];			v[7]  = 0.f;
+	v[8]  = (xz + wy) * s[2];			v[9]  = (yz - wx) * s[2];			v[10] = (1.f - (xx + yy)) * s[2];	v[11] = 0.f;
+	v[12] = t[0];						v[13] = t[1];						v[14] = t[2];						v[15] = 1.f;
+}
+
+struct alignas(16) scene_aabb {
+	float minv[4];
+	float maxv[4];
+};
+
+// Arvo: transform the center, and the extent by the absolute rotation/scale part
+static inline void
+aabb_transform(const float *m, const scene_aabb &a, scene_aabb &r) {
+#if defined(SCENE_SIMD_SSE)
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 mn = _mm_load_ps(a.minv), mx = _mm_load_ps(a.maxv);
+	const __m128 c = _mm_mul_ps(_mm_add_ps(mn, mx), half);
+	const __m128 e = _mm_mul_ps(_mm_sub_ps(mx, mn), half);
+	const __m128 m0 = _mm_loadu_ps(m), m1 = _mm_loadu_ps(m+4), m2 = _mm_loadu_ps(m+8), m3 = _mm_loadu_ps(m+12);
+	__m128 nc = _mm_add_ps(m3, _mm_mul_ps(m0, _mm_shuffle_ps(c, c, _MM_SHUFFLE(0,0,0,0))));
+	nc = _mm_add_ps(nc, _mm_mul_ps(m1, _mm_shuffle_ps(c, c, _MM_SHUFFLE(1,1,1,1))));
+	nc = _mm_add_ps(nc, _mm_mul_ps(m2, _mm_shuffle_ps(c, c, _MM_SHUFFLE(2,2,2,2))));
+	__m128 ne = _mm_mul_ps(_mm_and_ps(m0, absmask), _mm_shuffle_ps(e, e, _MM_SHUFFLE(0,0,0,0)));
+	ne = _mm_add_ps(ne, _mm_mul_ps(_mm_and_ps(m1, absmask), _mm_shuffle_ps(e, e, _MM_SHUFFLE(1,1,1,1))));
+	ne = _mm_add_ps(ne, _mm_mul_ps(_mm_and_ps(m2, absmask), _mm_shuffle_ps(e, e, _MM_SHUFFLE(2,2,2,2))));
+	_mm_store_ps(r.minv, _mm_sub_ps(nc, ne));
+	_mm_store_ps(r.maxv, _mm_add_ps(nc, ne));
+#elif defined(SCENE_SIMD_NEON)
+	const float32x4_t mn = vld1q_f32(a.minv), mx = vld1q_f32(a.maxv);
+	const float32x4_t c = vmulq_n_f32(vaddq_f32(mn, mx), 0.5f);
+	const float32x4_t e = vmulq_n_f32(vsubq_f32(mx, mn), 0.5f);
+	const float32x4_t m0 = vld1q_f32(m), m1 = vld1q_f32(m+4), m2 = vld1q_f32(m+8), m3 = vld1q_f32(m+12);
+	float32x4_t nc = vmlaq_n_f32(m3, m0, vgetq_lane_f32(c, 0));
+	nc = vmlaq_n_f32(nc, m1, vgetq_lane_f32(c, 1));
+	nc = vmlaq_n_f32(nc, m2, vgetq_lane_f32(c, 2));
+	float32x4_t ne = vmulq_n_f32(vabsq_f32(m0), vgetq_lane_f32(e, 0));
+	ne = vmlaq_n_f32(ne, vabsq_f32(m1), vgetq_lane_f32(e, 1));
+	ne = vmlaq_n_f32(ne, vabsq_f32(m2), vgetq_lane_f32(e, 2));
+	vst1q_f32(r.minv, vsubq_f32(nc, ne));
+	vst1q_f32(r.maxv, vaddq_f32(nc, ne));
+#else
+	float c[3], e[3];
+	for (int ii=0; ii<3; ++ii) {
+		c[ii] = (a.minv[ii] + a.maxv[ii]) * 0.5f;
+		e[ii] = (a.maxv[ii] - a.minv[ii]) * 0.5f;
+	}
+	for (int ii=0; ii<3; ++ii) {
+		const float nc = m[ii] * c[0] + m[4+ii] * c[1] + m[8+ii] * c[2] + m[12+ii];
+		const float ne = fabsf(m[ii]) * e[0] + fabsf(m[4+ii]) * e[1] + fabsf(m[8+ii]) * e[2];
+		r.minv[ii] = nc - ne;
+		r.maxv[ii] = nc + ne;
+	}
+#endif
+	r.minv[3] = a.minv[3];
+	r.maxv[3] = a.maxv[3];
+}
+
+// gathered by bounding_update, aabbs and the ids are published as scene_aabb_buffer
+struct scene_aabb_batch {
+	std::vector<component::bounding*>	boundings;
+	std::vector<const float*>			worldmats;
+	std::vector<scene_aabb>				locals;
+	std::vector<scene_aabb>				aabbs;
+	std::vector<uint64_t>				eids;
+	std::vector<uint64_t>				ids;
+	scene_aabb_buffer					buffer = {};
+
+	void clear() {
+		boundings.clear();
+		worldmats.clear();
+		locals.clear();
+		eids.clear();
+		buffer.n = 0;
+	}
+
+	void publish() {
+		buffer.eids = eids.data();
+		buffer.ids = ids.data();
+		buffer.aabbs = aabbs.data()->minv;
+		buffer.n = (uint32_t)eids.size();
+	}
+};
+
+struct worldmat_job {
+	scene_mat			world;
+	scene_mat			parentmat;	// used when the parent is not changed in this frame
+	scene_mat			mat;
+	float				s[4];
+	float				r[4];
+	float				t[4];
+	uint32_t			parent;		// job of the parent, INVALID if it uses parentmat
+	bool				root;
+	bool				has_mat;
+	component::scene*	scene;		// nullptr if the entity is not mutable, the job is skipped
+};
+
+static constexpr uint8_t MAX_SCENE_WORKER = 8;
+static constexpr uint32_t SCENE_CHUNK_SIZE = 256;
+
+// Scene entities in breadth first order, rebuilt only when entities are added/removed or a parent changes.
+// Parents always come before their children, the children of a node are contiguous,
+// and the nodes of depth d are in [levels[d], levels[d+1]).
+struct scene_hierarchy {
+	static constexpr uint32_t INVALID = UINT32_MAX;
+
+	struct node {
+		component::eid		eid;
+		component::eid		parent_eid;
+		uint32_t			parent;		// INVALID for roots and orphans
+		uint32_t			child_begin;
+		uint32_t			child_end;
+		uint32_t			depth;
+		uint32_t			job;		// index of jobs if it's changed in this frame
+		uint64_t			frame;		// scene is valid only when frame == ecs_world::frame
+		component::scene*	scene;
+	};
+
+	std::vector<node>					nodes;
+	std::vector<uint32_t>				levels;
+	flatmap<component::eid, uint32_t>	index;
+	bool								dirty = true;
+
+	std::vector<component::eid>			pending;
+	std::vector<uint32_t>				changed;
+	std::vector<worldmat_job>			jobs;
+	std::unique_ptr<job_pool>			pool;
+
+	scene_aabb_batch					aabb;
+
+	uint32_t find(component::eid eid) const {
+		auto v = index.find(eid);
+		return v ? *v : INVALID;
+	}
+
+	bool is_changed(component::eid eid) const {
+		const uint32_t idx = find(eid);
+		return idx != INVALID && nodes[idx].job != INVALID;
+	}
+
+	void check_parent(component::eid eid, component::eid parent) {
+		if (dirty)
+			return;
+		const uint32_t idx = find(eid);
+		if (idx == INVALID || nodes[idx].parent_eid != parent)
+			dirty = true;
+	}
+
+	void begin_frame() {
+		for (auto idx : changed) {
+			nodes[idx].job = INVALID;
+		}
+		changed.clear();
+	}
+
+	void rebuild(struct ecs_context *ctx);
+	void mark_changed();
+
+	void set_workers(int n) {
+		n = std::clamp(n, 1, (int)MAX_SCENE_WORKER);
+		pool.reset(n > 1 ? new job_pool(n) : nullptr);
+	}
+
+	int workers() const {
+		return pool ? pool->size() : 1;
+	}
+};
+
+void
+scene_hierarchy::rebuild(struct ecs_context *ctx) {
+	std::vector<component::eid> eids, parent_eids;
+	index.clear();
+	for (auto& e : ecs::select<component::scene, component::eid>(ctx)) {
+		const component::eid id = e.get<component::eid>();
+		index.insert_or_assign(id, (uint32_t)eids.size());
+		eids.push_back(id);
+		parent_eids.push_back((component::eid)e.get<component::scene>().parent);
+	}
+
+	const uint32_t n = (uint32_t)eids.size();
+	std::vector<uint32_t> parent(n, INVALID);
+	for (uint32_t ii=0; ii<n; ++ii) {
+		if (parent_eids[ii] != 0) {
+			const uint32_t p = find(parent_eids[ii]);
+			if (p != ii)
+				parent[ii] = p;
+		}
+	}
+
+	std::vector<uint32_t> first(n+1), children(n), depth(n), order;
+	order.reserve(n);
+	for (;;) {
+		std::fill(first.begin(), first.end(), 0);
+		for (uint32_t ii=0; ii<n; ++ii) {
+			if (parent[ii] != INVALID)
+				++first[parent[ii]+1];
+		}
+		for (uint32_t ii=0; ii<n; ++ii) {
+			first[ii+1] += first[ii];
+		}
+		std::vector<uint32_t> cursor(first.begin(), first.end()-1);
+		for (uint32_t ii=0; ii<n; ++ii) {
+			if (parent[ii] != INVALID)
+				children[cursor[parent[ii]]++] = ii;
+		}
+
+		order.clear();
+		std::fill(depth.begin(), depth.end(), INVALID);
+		for (uint32_t ii=0; ii<n; ++ii) {
+			if (parent[ii] == INVALID) {
+				depth[ii] = 0;
+				order.push_back(ii);
+			}
+		}
+		for (size_t ii=0; ii<order.size(); ++ii) {
+			const uint32_t u = order[ii];
+			for (uint32_t c=first[u]; c<first[u+1]; ++c) {
+				depth[children[c]] = depth[u] + 1;
+				order.push_back(children[c]);
 			}
 		}
-		mat = math3d_mul_matrix(math3d, *parentmat, mat);
+		if (order.size() == n)
+			break;
+		// the parents make a loop, cut them off as orphans
+		for (uint32_t ii=0; ii<n; ++ii) {
+			if (depth[ii] == INVALID)
+				parent[ii] = INVALID;
+		}
+	}
+
+	std::vector<uint32_t> pos(n);
+	for (uint32_t ii=0; ii<n; ++ii) {
+		pos[order[ii]] = ii;
+	}
+
+	nodes.resize(n);
+	levels.clear();
+	for (uint32_t ii=0; ii<n; ++ii) {
+		const uint32_t u = order[ii];
+		node &nd = nodes[ii];
+		nd.eid = eids[u];
+		nd.parent_eid = parent_eids[u];
+		nd.parent = parent[u] == INVALID ? INVALID : pos[parent[u]];
+		nd.child_begin = first[u] < first[u+1] ? pos[children[first[u]]] : 0;
+		nd.child_end = nd.child_begin + (first[u+1] - first[u]);
+		nd.depth = depth[u];
+		nd.job = INVALID;
+		nd.frame = ~0ull;
+		nd.scene = nullptr;
+		index.insert_or_assign(nd.eid, ii);
+		while (levels.size() <= nd.depth) {
+			levels.push_back(ii);
+		}
+	}
+	levels.push_back(n);
+	dirty = false;
+}
+
+// changed = pending entities and all their descendants, in hierarchy order
+void
+scene_hierarchy::mark_changed() {
+	for (auto eid : pending) {
+		const uint32_t idx = find(eid);
+		if (idx != INVALID && nodes[idx].job == INVALID) {
+			nodes[idx].job = 0;
+			changed.push_back(idx);
+		}
+	}
+	pending.clear();
+
+	for (size_t ii=0; ii<changed.size(); ++ii) {
+		const node &nd = nodes[changed[ii]];
+		for (uint32_t c=nd.child_begin; c<nd.child_end; ++c) {
+			if (nodes[c].job == INVALID) {
+				nodes[c].job = 0;
+				changed.push_back(c);
+			}
+		}
+	}
+
+	std::sort(changed.begin(), changed.end());
+	for (uint32_t ii=0; ii<(uint32_t)changed.size(); ++ii) {
+		nodes[changed[ii]].job = ii;
+	}
+}
+
+static inline void
+copy_value(struct math_context* math3d, math_t id, float *v, int n) {
+	memcpy(v, math_value(math3d, id), n * sizeof(float));
+}
+
+static inline void
+copy_mat(struct math_context* math3d, math_t id, scene_mat &m) {
+	if (math_isnull(id)) {
+		mat_identity(m);
+	} else {
+		copy_value(math3d, id, m.v, 16);
+	}
+}
+
+// copy the inputs out of math3d, returns the job whose parent can't be found, or INVALID
+static uint32_t
+worldmat_gather(struct ecs_world *w, scene_hierarchy &h) {
+	auto math3d = w->math3d->M;
+	const uint32_t num = (uint32_t)h.changed.size();
+	h.jobs.resize(num);
+	for (uint32_t ii=0; ii<num; ++ii) {
+		const auto &nd = h.nodes[h.changed[ii]];
+		auto &j = h.jobs[ii];
+		j.scene = nd.frame == w->frame ? nd.scene : nullptr;
+		if (!j.scene)
+			continue;
+		const auto &s = *j.scene;
+		copy_value(math3d, s.s, j.s, 4);
+		copy_value(math3d, s.r, j.r, 4);
+		copy_value(math3d, s.t, j.t, 4);
+		j.has_mat = !math_isnull(s.mat);
+		if (j.has_mat) {
+			copy_value(math3d, s.mat, j.mat.v, 16);
+		}
+
+		j.parent = scene_hierarchy::INVALID;
+		j.root = nd.parent_eid == 0;
+		if (j.root)
+			continue;
+		if (nd.parent == scene_hierarchy::INVALID)
+			return ii;
+		const auto &pn = h.nodes[nd.parent];
+		if (pn.job != scene_hierarchy::INVALID && h.jobs[pn.job].scene) {
+			j.parent = pn.job;
+			continue;
+		}
+		component::scene *ps = pn.frame == w->frame ? pn.scene : nullptr;
+		if (!ps) {
+			auto e = ecs::find_entity(w->ecs, pn.eid);
+			if (e.invalid())
+				return ii;
+			ps = e.component<component::scene>();
+			if (ps == nullptr)
+				return ii;
+		}
+		copy_mat(math3d, ps->worldmat, j.parentmat);
+	}
+	return scene_hierarchy::INVALID;
+}
+
+static inline void
+worldmat_eval(worldmat_job *jobs, uint32_t from, uint32_t to) {
+	for (uint32_t ii=from; ii<to; ++ii) {
+		auto &j = jobs[ii];
+		if (!j.scene)
+			continue;
+		scene_mat local;
+		mat_srt(j.s, j.r, j.t, local);
+		if (j.has_mat) {
+			scene_mat m;
+			mat_mul(local, j.mat, m);
+			local = m;
+		}
+		if (j.root) {
+			j.world = local;
+		} else {
+			mat_mul(j.parent == scene_hierarchy::INVALID ? j.parentmat : jobs[j.parent].world, local, j.world);
+		}
+	}
+}
+
+// one depth at a time, the nodes in the same depth don't depend on each other
+static void
+worldmat_eval_levels(scene_hierarchy &h) {
+	const uint32_t num = (uint32_t)h.changed.size();
+	worldmat_job *jobs = h.jobs.data();
+	uint32_t from = 0;
+	while (from < num) {
+		const uint32_t depth = h.nodes[h.changed[from]].depth;
+		const uint32_t to = (uint32_t)(std::lower_bound(h.changed.begin() + from, h.changed.end(), h.levels[depth+1]) - h.changed.begin());
+		if (!h.pool || to - from < SCENE_CHUNK_SIZE * 2) {
+			worldmat_eval(jobs, from, to);
+		} else {
+			std::atomic<uint32_t> next{from};
+			h.pool->run([&](int) {
+				for (uint32_t f = next.fetch_add(SCENE_CHUNK_SIZE); f < to; f = next.fetch_add(SCENE_CHUNK_SIZE)) {
+					worldmat_eval(jobs, f, std::min(f + SCENE_CHUNK_SIZE, to));
+				}
+			});
+		}
+		from = to;
+	}
+}
+
+static void
+worldmat_commit(struct math_context* math3d, scene_hierarchy &h) {
+	for (auto &j : h.jobs) {
+		if (j.scene) {
+			math3d_update(math3d, j.scene->worldmat, math_import(math3d, j.world.v, MATH_TYPE_MAT, 1));
+		}
 	}
-	math3d_update(math3d, s.worldmat, mat);
-	worldmats.insert_or_assign(id, s.worldmat);
-	return true;
 }
 
 #define MUTABLE_TICK 128
 
+static int
+init_system(lua_State *L) {
+	auto w = getworld(L);
+	w->scene_hierarchy = new struct scene_hierarchy;
+	w->scene_aabbs = &w->scene_hierarchy->aabb.buffer;
+	return 0;
+}
+
+static int
+exit_system(lua_State *L) {
+	auto w = getworld(L);
+	delete w->scene_hierarchy;
+	w->scene_hierarchy = nullptr;
+	w->scene_aabbs = nullptr;
+	return 0;
+}
+
+static int
+scene_workers(lua_State *L) {
+	auto w = getworld(L);
+	w->scene_hierarchy->set_workers((int)luaL_checkinteger(L, 1));
+	lua_pushinteger(L, w->scene_hierarchy->workers());
+	return 1;
+}
+
 static int
 entity_init(lua_State *L) {
 	auto w = getworld(L);
@@ -73,6 +532,7 @@ entity_init(lua_State *L) {
 		s.movement = 0;
 		e.enable_tag<component::scene_mutable>();
 		e.enable_tag<component::scene_needchange>();
+		w->scene_hierarchy->dirty = true;
 	}
 	return 0;
 }
@@ -86,19 +546,12 @@ is_constant(struct ecs_world *w, component::eid eid) {
 	return !e.component<component::scene_mutable>();
 }
 
-static inline bool
-is_changed(flatset<component::eid> &changed, component::eid eid) {
-	return changed.contains(eid);
-}
-
 static void
-rebuild_mutable_set(struct ecs_world *w, flatset<component::eid> &changed) {
+rebuild_mutable_set(struct ecs_world *w, const scene_hierarchy &h) {
 	using namespace ecs::flags;
 	for (auto& e : ecs::select< component::scene, component::scene_mutable(absent), component::eid>(w->ecs)) {
-		auto& s = e.get<component::scene>();
-		if (s.parent != 0 && is_changed(changed, s.parent)) {
+		if (h.is_changed(e.get<component::eid>())) {
 			e.enable_tag<component::scene_mutable>();
-			changed.insert(e.get<component::eid>());
 		}
 	}
 }
@@ -108,8 +561,7 @@ scene_changed(lua_State *L) {
 	auto w = getworld(L);
 	auto math3d = w->math3d->M;
 	math3d_checkpoint cp(math3d);
-
-	flatset<component::eid> changed;
+	auto &h = *w->scene_hierarchy;
 
 	// step.1
 	auto selector = ecs::select<component::scene_needchange, component::eid>(w->ecs);
@@ -117,6 +569,7 @@ scene_changed(lua_State *L) {
 	if (it == selector.end()) {
 		return 0;
 	}
+	h.begin_frame();
 	bool need_rebuild_mutable_set = false;
 	for (; it != selector.end(); ++it) {
 		auto& e = *it;
@@ -125,36 +578,49 @@ scene_changed(lua_State *L) {
 			e.enable_tag<component::scene_mutable>();
 		}
 		auto eid = e.get<component::eid>();
-		changed.insert(eid);
+		if (auto s = e.component<component::scene>()) {
+			h.check_parent(eid, (component::eid)s->parent);
+		}
+		h.pending.push_back(eid);
 	}
 
 	ecs::clear_type<component::scene_needchange>(w->ecs);
 
+	if (h.dirty) {
+		h.rebuild(w->ecs);
+	}
+	h.mark_changed();
+
 	if (need_rebuild_mutable_set) {
-		rebuild_mutable_set(w, changed);
+		rebuild_mutable_set(w, h);
 	}
 
 	// step.2
-	flatmap<component::eid, math_t> worldmats;
 	for (auto& e : ecs::select<component::scene_mutable, component::scene, component::eid>(w->ecs)) {
 		auto& s = e.get<component::scene>();
-		component::eid id = e.get<component::eid>();
-		auto selfchanged = is_changed(changed, id);
-		if (selfchanged || (s.parent != 0 && is_changed(changed, s.parent))) {
+		const uint32_t idx = h.find(e.get<component::eid>());
+		if (idx == scene_hierarchy::INVALID)
+			continue;
+		auto &nd = h.nodes[idx];
+		nd.frame = w->frame;
+		nd.scene = &s;
+		if (nd.job != scene_hierarchy::INVALID) {
 			e.enable_tag<component::scene_changed>();
-			if (!worldmat_update(worldmats, math3d, s, id, w)) {
-				return luaL_error(L, "entity(%d)'s parent(%d) cannot be found.", id, s.parent);
-			}
 			s.movement = w->frame;
-			if (!selfchanged){
-				changed.insert(id);
-			}
 		} else if (w->frame - s.movement > MUTABLE_TICK &&
 			(s.parent == 0 || is_constant(w, s.parent))) {
 			e.disable_tag<component::scene_mutable>();
 		}
 	}
 
+	const uint32_t missing = worldmat_gather(w, h);
+	if (missing != scene_hierarchy::INVALID) {
+		const auto &nd = h.nodes[h.changed[missing]];
+		return luaL_error(L, "entity(%d)'s parent(%d) cannot be found.", (int)nd.eid, (int)nd.parent_eid);
+	}
+	worldmat_eval_levels(h);
+	worldmat_commit(math3d, h);
+
 	++w->frame;
 
 	return 0;
@@ -164,6 +630,8 @@ static int
 end_frame(lua_State *L) {
 	auto w = getworld(L);
 	ecs::clear_type<component::scene_changed>(w->ecs);
+	ecs::clear_type<component::bounding_changed>(w->ecs);
+	w->scene_aabbs->n = 0;
 	return 0;
 }
 
@@ -178,6 +646,7 @@ scene_remove(lua_State *L) {
 	}
 
 	entity_propagate_tag(w->ecs, ecs::component_id<component::scene>, ecs::component_id<component::REMOVED>);
+	w->scene_hierarchy->dirty = true;
 
 	return 0;
 }
@@ -187,14 +656,34 @@ bounding_update(lua_State *L){
 	auto w = getworld(L);
 	auto math3d = w->math3d->M;
 	math3d_checkpoint cp(math3d);
-	for (auto& e : ecs::select<component::scene_changed, component::bounding, component::scene>(w->ecs)){
+	auto &batch = w->scene_hierarchy->aabb;
+	batch.clear();
+	for (auto& e : ecs::select<component::scene_changed, component::bounding, component::scene, component::eid>(w->ecs)){
 		auto &b = e.get<component::bounding>();
 		if (math_isnull(b.aabb))
 			continue;
 		const auto &s = e.get<component::scene>();
-		const math_t aabb = math3d_aabb_transform(math3d, s.worldmat, b.aabb);
-		math3d_update(math3d, b.scene_aabb, aabb);
+		batch.boundings.push_back(&b);
+		batch.worldmats.push_back(math_value(math3d, s.worldmat));
+		memcpy(&batch.locals.emplace_back(), math_value(math3d, b.aabb), sizeof(scene_aabb));
+		batch.eids.push_back((uint64_t)e.get<component::eid>());
+		e.enable_tag<component::bounding_changed>();
+	}
+
+	const size_t n = batch.locals.size();
+	if (n == 0)
+		return 0;
+	batch.aabbs.resize(n);
+	batch.ids.resize(n);
+	for (size_t ii=0; ii<n; ++ii) {
+		aabb_transform(batch.worldmats[ii], batch.locals[ii], batch.aabbs[ii]);
+	}
+	for (size_t ii=0; ii<n; ++ii) {
+		math_t &id = batch.boundings[ii]->scene_aabb;
+		math3d_update(math3d, id, math_import(math3d, batch.aabbs[ii].minv, MATH_TYPE_VEC4, 2));
+		batch.ids[ii] = id.idx;
 	}
+	batch.publish();
 	return 0;
 }
 
@@ -202,6 +691,9 @@ extern "C" int
 luaopen_system_scene(lua_State *L) {
 	luaL_checkversion(L);
 	luaL_Reg l[] = {
+		{ "init_system", init_system },
+		{ "exit", exit_system },
+		{ "scene_workers", scene_workers },
 		{ "entity_init", entity_init },
 		{ "scene_changed", scene_changed },
 		{ "end_frame", end_frame },
@@ -0,0 +1,13 @@
+local ecs	= ...
+local world	= ecs.world
+
+local setting				= import_package "ant.settings"
+local SCENE_WORKERS<const>	= setting:get "graphic/scene/workers" or 1
+
+local scenecore = world:clibs "system.scene"
+
+local sw_sys = ecs.system "scene_worker_system"
+
+function sw_sys:init()
+	scenecore.scene_workers(SCENE_WORKERS)
+end
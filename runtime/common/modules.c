@@ -60,6 +60,7 @@ int luaopen_programan_server(lua_State *L);
 int luaopen_render_material(lua_State *L);
 int luaopen_render_queue(lua_State *L);
 int luaopen_render_stat(lua_State *L);
+int luaopen_render_tileculling(lua_State *L);
 int luaopen_rmlui(lua_State* L);
 int luaopen_system_cull(lua_State* L);
 int luaopen_system_render(lua_State *L);
@@ -121,6 +122,7 @@ void ant_loadmodules(lua_State* L) {
         { "render.queue",           luaopen_render_queue},
         { "system.render",      luaopen_system_render},
         { "render.stat",        luaopen_render_stat},
+        { "render.tileculling", luaopen_render_tileculling},
         { "motion.sampler",     luaopen_motion_sampler},
         { "motion.tween",       luaopen_motion_tween},
         { "image", luaopen_image },